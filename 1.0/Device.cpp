@@ -17,12 +17,24 @@
 #define LOG_TAG "android.hardware.neuralnetworks@1.0-impl-hvx"
 
 #include "Device.h"
+#include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/properties.h>
+#include <algorithm>
+#include <chrono>
 #include <memory>
 #include <mutex>
-#include <thread>
+#include "HexagonCalibration.h"
+#include "HexagonCompilationCache.h"
+#include "HexagonDispatcher.h"
+#include "HexagonGraphEvictor.h"
+#include "HexagonMemoryBudget.h"
 #include "HexagonModel.h"
+#include "HexagonPowerManager.h"
+#include "HexagonShapeCache.h"
+#include "HexagonTiming.h"
 #include "HexagonUtils.h"
+#include "HexagonWatchdog.h"
 #include "PreparedModel.h"
 
 namespace android {
@@ -39,26 +51,14 @@ static std::once_flag configure_nnlib;
 static void configureHexagon() {
     std::call_once(configure_nnlib, []() {
         hexagon::Controller::getInstance().config();
-        hexagon::Controller::getInstance().boost(100);
+        hexagon::PowerManager::getInstance().apply();
     });
 }
 
 Return<void> Device::getCapabilities(getCapabilities_cb _hidl_cb) {
     configureHexagon();
 
-    // These numbers are approximations for this release.
-    // TODO Change with the actual number.
-    PerformanceInfo float32Performance = {
-        .execTime = 30.0f, .powerUsage = 2.0f,
-    };
-
-    PerformanceInfo quantized8Performance = {
-        .execTime = 0.7f, .powerUsage = 0.7f,
-    };
-
-    Capabilities capabilities = {
-        .float32Performance = float32Performance, .quantized8Performance = quantized8Performance,
-    };
+    Capabilities capabilities = hexagon::Calibration::getInstance().getCapabilities();
 
     ErrorStatus status =
         hexagon::isHexagonAvailable() ? ErrorStatus::NONE : ErrorStatus::DEVICE_UNAVAILABLE;
@@ -87,29 +87,85 @@ Return<void> Device::getSupportedOperations(const Model& model,
     return Void();
 }
 
-static void asyncPrepare(const Model& model, const sp<IPreparedModelCallback>& callback) {
-    std::shared_ptr<hexagon::Model> hexagonModel = std::make_shared<hexagon::Model>(model);
+// Runs the prepared model once on scratch inputs, so that DSP-side buffer
+// allocation, cold weights and clock ramp are paid during preparation rather
+// than by the first execution.
+static void warmUpModel(const Model& model, hexagon::Model* hexagonModel) {
+    const auto start = std::chrono::steady_clock::now();
+    Request request;
+    const bool success =
+        hexagon::createScratchRequest(model, &request) && hexagonModel->execute(request);
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    LOG(INFO) << "Post-prepare warm-up " << (success ? "completed" : "failed") << ", adding "
+              << std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()
+              << " us to the preparation";
+}
 
-    Return<void> ret;
-    if (hexagonModel->prepare()) {
-        ret = callback->notify(ErrorStatus::NONE, new PreparedModel(model, hexagonModel));
-    } else {
-        ret = callback->notify(ErrorStatus::GENERAL_FAILURE, nullptr);
-    }
+static void notify(const sp<IPreparedModelCallback>& callback, ErrorStatus status,
+                   const sp<IPreparedModel>& preparedModel) {
+    Return<void> ret = callback->notify(status, preparedModel);
     if (!ret.isOk()) {
         LOG(ERROR) << "Error in callback's return type: " << ret.description();
     }
 }
 
-Return<ErrorStatus> Device::prepareModel(const Model& model,
-                                         const sp<IPreparedModelCallback>& callback) {
-    configureHexagon();
+// An empty directory bypasses the compilation cache.
+static void asyncPrepare(const Model& model, const std::string& directory,
+                         const hexagon::CacheToken& token,
+                         const sp<IPreparedModelCallback>& callback) {
+    // models with inputs of unknown shape are lowered on execution, once the
+    // shapes are known; what can be checked already is checked now
+    if (hexagon::ShapeCache::hasDynamicInputs(model)) {
+        if (!hexagon::Model(model).verifyWithUnknownDimensions()) {
+            notify(callback, ErrorStatus::GENERAL_FAILURE, nullptr);
+            return;
+        }
+        notify(callback, ErrorStatus::NONE, new PreparedModel(model, nullptr));
+        return;
+    }
+
+    hexagon::CompilationCache& cache = hexagon::CompilationCache::getInstance();
+    hexagon::CompilationCache::Entry entry;
+    std::shared_ptr<hexagon::Model> hexagonModel;
+    if (!directory.empty() && cache.load(directory, token, &entry)) {
+        hexagonModel = entry.model;
+    } else {
+        hexagonModel = std::make_shared<hexagon::Model>(model);
+        if (!hexagonModel->prepare()) {
+            notify(callback, ErrorStatus::GENERAL_FAILURE, nullptr);
+            return;
+        }
+        if (!directory.empty()) {
+            cache.store(directory, token, *hexagonModel, hexagon::RequestValidator(model));
+        }
+    }
+
+    if (::android::base::GetBoolProperty("vendor.hvx.prepare.warmup", false)) {
+        warmUpModel(model, hexagonModel.get());
+    }
+    hexagonModel->compact();
+    notify(callback, ErrorStatus::NONE, new PreparedModel(model, hexagonModel));
+}
+
+static void asyncPrepareFromCache(const std::string& directory, const hexagon::CacheToken& token,
+                                  const sp<IPreparedModelCallback>& callback) {
+    hexagon::CompilationCache::Entry entry;
+    if (!hexagon::CompilationCache::getInstance().load(directory, token, &entry)) {
+        notify(callback, ErrorStatus::GENERAL_FAILURE, nullptr);
+        return;
+    }
+    notify(callback, ErrorStatus::NONE,
+           new PreparedModel(hexagon::RequestValidator(entry.inputs, entry.outputs), entry.model));
+}
 
+// Returns NONE if the model can be prepared, or notifies callback of the
+// error.
+static ErrorStatus checkPrepare(const Model* model, const sp<IPreparedModelCallback>& callback) {
     if (callback.get() == nullptr) {
         LOG(ERROR) << "invalid callback passed to prepareModel";
         return ErrorStatus::INVALID_ARGUMENT;
     }
-    if (!nn::validateModel(model)) {
+    if (model != nullptr && !nn::validateModel(*model)) {
         callback->notify(ErrorStatus::INVALID_ARGUMENT, nullptr);
         return ErrorStatus::INVALID_ARGUMENT;
     }
@@ -117,10 +173,69 @@ Return<ErrorStatus> Device::prepareModel(const Model& model,
         callback->notify(ErrorStatus::DEVICE_UNAVAILABLE, nullptr);
         return ErrorStatus::DEVICE_UNAVAILABLE;
     }
+    return ErrorStatus::NONE;
+}
+
+Return<ErrorStatus> Device::prepareModel(const Model& model,
+                                         const sp<IPreparedModelCallback>& callback) {
+    configureHexagon();
+    const ErrorStatus status = checkPrepare(&model, callback);
+    if (status != ErrorStatus::NONE) {
+        return status;
+    }
+
+    // hung nnlib calls are recovered by the watchdog; without a client token
+    // the model is cached under a hash of its content, if that is enabled
+    hexagon::Dispatcher::getInstance().post([model, callback]() {
+        const std::string& directory =
+            hexagon::CompilationCache::getInstance().getDefaultDirectory();
+        asyncPrepare(model, directory,
+                     directory.empty() ? hexagon::CacheToken{}
+                                       : hexagon::CompilationCache::getToken(model),
+                     callback);
+    });
+
+    return ErrorStatus::NONE;
+}
+
+Return<ErrorStatus> Device::prepareModelWithCache(const Model& model, const std::string& directory,
+                                                  const hexagon::CacheToken& token,
+                                                  const sp<IPreparedModelCallback>& callback) {
+    configureHexagon();
+    const ErrorStatus status = checkPrepare(&model, callback);
+    if (status != ErrorStatus::NONE) {
+        return status;
+    }
+    if (!hexagon::CompilationCache::getInstance().isOwned(directory)) {
+        LOG(ERROR) << "invalid cache directory passed to prepareModelWithCache";
+        callback->notify(ErrorStatus::INVALID_ARGUMENT, nullptr);
+        return ErrorStatus::INVALID_ARGUMENT;
+    }
+
+    hexagon::Dispatcher::getInstance().post([model, directory, token, callback]() {
+        asyncPrepare(model, directory, token, callback);
+    });
+
+    return ErrorStatus::NONE;
+}
+
+Return<ErrorStatus> Device::prepareModelFromCache(const std::string& directory,
+                                                  const hexagon::CacheToken& token,
+                                                  const sp<IPreparedModelCallback>& callback) {
+    configureHexagon();
+    const ErrorStatus status = checkPrepare(nullptr, callback);
+    if (status != ErrorStatus::NONE) {
+        return status;
+    }
+    if (!hexagon::CompilationCache::getInstance().isOwned(directory)) {
+        LOG(ERROR) << "invalid cache directory passed to prepareModelFromCache";
+        callback->notify(ErrorStatus::INVALID_ARGUMENT, nullptr);
+        return ErrorStatus::INVALID_ARGUMENT;
+    }
 
-    // TODO: once nnlib hanging issue is resolved, make this function
-    // asynchronous again
-    asyncPrepare(model, callback);
+    hexagon::Dispatcher::getInstance().post([directory, token, callback]() {
+        asyncPrepareFromCache(directory, token, callback);
+    });
 
     return ErrorStatus::NONE;
 }
@@ -132,6 +247,53 @@ Return<DeviceStatus> Device::getStatus() {
     return mCurrentStatus;
 }
 
+void Device::warmUp() {
+    const auto start = std::chrono::steady_clock::now();
+    configureHexagon();
+    if (!hexagon::isHexagonAvailable()) {
+        LOG(INFO) << "Hexagon is not available, skipping warm-up";
+        return;
+    }
+
+    bool success = false;
+    {
+        const Model canary = hexagon::getCanaryModel();
+        Request request;
+        if (hexagon::createScratchRequest(canary, &request)) {
+            hexagon::Model hexagonModel(canary);
+            success = hexagonModel.prepare() && hexagonModel.execute(request);
+        }
+    }
+
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    LOG(INFO) << "Warm-up " << (success ? "completed" : "failed") << " in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() << " ms";
+
+    // loads the persisted calibration, or measures it on the first boot,
+    // behind the clients
+    hexagon::Calibration::getInstance().start();
+}
+
+Return<void> Device::debug(const hidl_handle& handle, const hidl_vec<hidl_string>& options) {
+    if (handle.getNativeHandle() == nullptr || handle->numFds < 1) {
+        LOG(ERROR) << "invalid handle passed to debug";
+        return Void();
+    }
+    const int fd = handle->data[0];
+
+    std::string os = hexagon::PowerManager::getInstance().dump();
+    os += hexagon::Dispatcher::getInstance().dump();
+    os += hexagon::MemoryBudget::getInstance().dump();
+    os += hexagon::CompilationCache::getInstance().dump();
+    os += hexagon::GraphEvictor::getInstance().dump();
+    os += hexagon::Watchdog::getInstance().dump();
+    const bool verboseTiming =
+        std::find(options.begin(), options.end(), "--timing") != options.end();
+    os += hexagon::TimingReport::getInstance().dump(verboseTiming);
+    ::android::base::WriteStringToFd(os, fd);
+    return Void();
+}
+
 }  // namespace implementation
 }  // namespace V1_0
 }  // namespace neuralnetworks
@@ -23,6 +23,7 @@
 #include <hidl/MQDescriptor.h>
 #include <hidl/Status.h>
 #include <string>
+#include "HexagonCompilationCache.h"
 
 namespace android {
 namespace hardware {
@@ -32,6 +33,7 @@ namespace implementation {
 
 using ::android::sp;
 using ::android::hardware::hidl_array;
+using ::android::hardware::hidl_handle;
 using ::android::hardware::hidl_memory;
 using ::android::hardware::hidl_string;
 using ::android::hardware::hidl_vec;
@@ -50,6 +52,25 @@ struct Device : public IDevice {
                                      const sp<IPreparedModelCallback>& callback) override;
     Return<DeviceStatus> getStatus() override;
 
+    // Methods from ::android::hidl::base::V1_0::IBase follow.
+    Return<void> debug(const hidl_handle& handle, const hidl_vec<hidl_string>& options) override;
+
+    // Loads nnlib, configures the DSP and runs a canary graph, so that the
+    // first client does not pay for any of it.
+    void warmUp();
+
+    // IDevice 1.0 cannot carry a client's cache token, so the following are
+    // meant for a vendor extension. prepareModelWithCache prepares model and
+    // stores it in directory under token; prepareModelFromCache prepares the
+    // model stored there, without the NNAPI model. directory must be owned by
+    // the compilation cache, see CompilationCache::isOwned.
+    Return<ErrorStatus> prepareModelWithCache(const Model& model, const std::string& directory,
+                                              const hexagon::CacheToken& token,
+                                              const sp<IPreparedModelCallback>& callback);
+    Return<ErrorStatus> prepareModelFromCache(const std::string& directory,
+                                              const hexagon::CacheToken& token,
+                                              const sp<IPreparedModelCallback>& callback);
+
    private:
     DeviceStatus mCurrentStatus;
 };
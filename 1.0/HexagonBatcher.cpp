@@ -0,0 +1,290 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "android.hardware.neuralnetworks@1.0-impl-hvx"
+
+#include "HexagonBatcher.h"
+#include <android-base/logging.h>
+#include <android-base/properties.h>
+#include <algorithm>
+#include <cstring>
+#include "HexagonMemoryBudget.h"
+#include "HexagonUtils.h"
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+
+namespace {
+
+bool isBatchable(const NeuralnetworksModel& model) {
+    // every input and output must be a single sample along the leading
+    // dimension, which then becomes the batch dimension
+    auto isSingleSample = [&model](uint32_t index) {
+        const hidl_vec<uint32_t>& dims = model.operands[index].dimensions;
+        return dims.size() > 0 && dims[0] == 1;
+    };
+    for (uint32_t index : model.inputIndexes) {
+        HEXAGON_SOFT_ASSERT(isSingleSample(index), "input " << index << " is not one sample");
+    }
+    for (uint32_t index : model.outputIndexes) {
+        HEXAGON_SOFT_ASSERT(isSingleSample(index), "output " << index << " is not one sample");
+    }
+
+    // operations that mix samples, or bake the batch size into their
+    // parameters, cannot be stacked
+    for (const Operation& operation : model.operations) {
+        HEXAGON_SOFT_ASSERT(operation.type != OperationType::RESHAPE,
+                            "RESHAPE has a fixed target shape");
+        if (operation.type == OperationType::CONCATENATION) {
+            const Operand& axis = model.operands[operation.inputs[operation.inputs.size() - 1]];
+            HEXAGON_SOFT_ASSERT(axis.lifetime == OperandLifeTime::CONSTANT_COPY,
+                                "CONCATENATION axis is not known");
+            int32_t value = 0;
+            std::memcpy(&value, model.operandValues.data() + axis.location.offset, sizeof(value));
+            HEXAGON_SOFT_ASSERT_NE(0, value, "CONCATENATION along the batch dimension");
+        }
+    }
+
+    return true;
+}
+
+}  // anonymous namespace
+
+Batcher::Batcher(uint32_t batchSize, std::chrono::microseconds budget,
+                 const std::shared_ptr<Model>& batchedModel,
+                 const std::vector<uint32_t>& inputSizes,
+                 const std::vector<uint32_t>& outputSizes)
+    : mBatchSize(batchSize),
+      mBudget(budget),
+      mBatchedModel(batchedModel),
+      mInputSizes(inputSizes),
+      mOutputSizes(outputSizes),
+      mStopping(false) {}
+
+Batcher::~Batcher() {
+    MemoryBudget::getInstance().forget(this);
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mQueued.notify_all();
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+}
+
+uint32_t Batcher::sBatchSizeForTesting = 0;
+
+std::unique_ptr<Batcher> Batcher::create(const NeuralnetworksModel& model,
+                                         const std::shared_ptr<Model>& hexagonModel) {
+    const uint32_t batchSize =
+        sBatchSizeForTesting != 0
+            ? sBatchSizeForTesting
+            : ::android::base::GetUintProperty<uint32_t>("vendor.hvx.batch.size", 0);
+    if (batchSize < 2 || !isBatchable(model)) {
+        return nullptr;
+    }
+    const std::chrono::microseconds budget(
+        ::android::base::GetUintProperty<uint32_t>("vendor.hvx.batch.budget_us", 2000));
+
+    // Scale the leading dimension of the inputs and outputs. The shapes of
+    // the temporaries are propagated again by the operation checks.
+    NeuralnetworksModel batched = model;
+    std::vector<uint32_t> inputSizes;
+    std::vector<uint32_t> outputSizes;
+    for (uint32_t index : batched.inputIndexes) {
+        inputSizes.push_back(getSize(batched.operands[index]));
+        batched.operands[index].dimensions[0] = batchSize;
+    }
+    for (uint32_t index : batched.outputIndexes) {
+        outputSizes.push_back(getSize(batched.operands[index]));
+        batched.operands[index].dimensions[0] = batchSize;
+    }
+
+    std::shared_ptr<Model> batchedModel = std::make_shared<Model>(batched);
+    if (!batchedModel->prepare()) {
+        LOG(INFO) << "Model cannot be prepared for a batch of " << batchSize;
+        return nullptr;
+    }
+    for (uint32_t index : batched.outputIndexes) {
+        const std::vector<uint32_t> dims = batchedModel->getShape(index).dimensions;
+        if (dims != std::vector<uint32_t>(batched.operands[index].dimensions)) {
+            LOG(INFO) << "Output " << index << " does not scale with the batch";
+            return nullptr;
+        }
+    }
+    // the constants that batching leaves alone are held once on the host,
+    // and the graph of the model is only materialized again for requests
+    // that cannot be batched
+    batchedModel->shareConstants(*hexagonModel);
+    batchedModel->compact();
+    hexagonModel->evict();
+
+    std::unique_ptr<Batcher> batcher(
+        new Batcher(batchSize, budget, batchedModel, inputSizes, outputSizes));
+    if (!createScratchRequest(batched, &batcher->mStagingRequest) || !batcher->initialize()) {
+        return nullptr;
+    }
+
+    LOG(INFO) << "Batching up to " << batchSize << " requests within " << budget.count() << " us";
+    return batcher;
+}
+
+bool Batcher::initialize() {
+    // mapped once, for every batch
+    HEXAGON_SOFT_ASSERT(mapPools(mStagingRequest.pools, &mStaging) && mStaging.size() == 1,
+                        "Error mapping the staging pool");
+    MemoryBudget::getInstance().setHostBytes(this, mStaging[0]->hidlMemory.size());
+    mThread = std::thread([this]() { batchLoop(); });
+    return true;
+}
+
+bool Batcher::accepts(const Request& request) const {
+    // a sample is copied whole to and from each argument, which the
+    // validator only keeps within its pool
+    auto isSample = [](const hidl_vec<RequestArgument>& arguments,
+                       const std::vector<uint32_t>& sizes) {
+        if (arguments.size() != sizes.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < arguments.size(); ++i) {
+            const RequestArgument& argument = arguments[i];
+            if (argument.hasNoValue || argument.dimensions.size() != 0 ||
+                argument.location.length != sizes[i]) {
+                return false;
+            }
+        }
+        return true;
+    };
+    return isSample(request.inputs, mInputSizes) && isSample(request.outputs, mOutputSizes);
+}
+
+void Batcher::enqueue(const Request& request, const Client& client,
+                      std::function<void(bool, const Timing&)> done) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mQueue.emplace_back(
+            std::chrono::steady_clock::now(),
+            Pending{.request = request, .client = client, .done = std::move(done)});
+    }
+    mQueued.notify_one();
+}
+
+void Batcher::batchLoop() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (true) {
+        mQueued.wait(lock, [this]() { return mStopping || !mQueue.empty(); });
+        if (mQueue.empty()) {
+            return;
+        }
+
+        // hold the oldest request for at most the latency budget
+        const std::chrono::steady_clock::time_point deadline = mQueue.front().first + mBudget;
+        mQueued.wait_until(lock, deadline,
+                           [this]() { return mStopping || mQueue.size() >= mBatchSize; });
+
+        std::vector<Pending> batch;
+        while (!mQueue.empty() && batch.size() < mBatchSize) {
+            batch.push_back(std::move(mQueue.front().second));
+            mQueue.pop_front();
+        }
+        lock.unlock();
+
+        // a lone request runs on the batched graph too, padded with zeros,
+        // so that the graph of the model does not have to stay on the DSP
+        executeBatch(&batch);
+
+        lock.lock();
+    }
+}
+
+void Batcher::executeBatch(std::vector<Pending>* batch) {
+    uint8_t* staging = mStaging[0]->buffer;
+
+    // gather; a request whose pools cannot be mapped fails right away, and
+    // its slot is zeroed rather than left holding a previous batch
+    std::vector<std::vector<RunTimePoolInfo>> pools(batch->size());
+    std::vector<bool> mapped(batch->size());
+    for (size_t k = 0; k < batch->size(); ++k) {
+        const Request& request = (*batch)[k].request;
+        pools[k] = mapPools(request.pools);
+        mapped[k] = pools[k].size() == request.pools.size();
+        if (!mapped[k]) {
+            LOG(ERROR) << "Error mapping the pools of a batched request";
+            Timing timing;
+            timing.pid = (*batch)[k].client.pid;
+            (*batch)[k].done(false, timing);
+        }
+        for (size_t i = 0; i < mInputSizes.size(); ++i) {
+            uint8_t* slot =
+                staging + mStagingRequest.inputs[i].location.offset + k * mInputSizes[i];
+            if (mapped[k]) {
+                const DataLocation& location = request.inputs[i].location;
+                std::memcpy(slot, pools[k][location.poolIndex].buffer + location.offset,
+                            mInputSizes[i]);
+            } else {
+                std::memset(slot, 0, mInputSizes[i]);
+            }
+        }
+    }
+    for (size_t i = 0; i < mInputSizes.size(); ++i) {
+        const size_t used = batch->size() * mInputSizes[i];
+        std::memset(staging + mStagingRequest.inputs[i].location.offset + used, 0,
+                    (mBatchSize - batch->size()) * mInputSizes[i]);
+    }
+
+    // the batch runs at the priority of its most urgent request
+    Client client = (*batch)[0].client;
+    for (const Pending& pending : *batch) {
+        if (pending.client.workload < client.workload) {
+            client = pending.client;
+        }
+    }
+    Timing timing;
+    const bool success = mBatchedModel->execute(mStagingRequest, mStaging, client, &timing);
+
+    // scatter
+    for (size_t k = 0; k < batch->size(); ++k) {
+        if (!mapped[k]) {
+            continue;
+        }
+        const Request& request = (*batch)[k].request;
+        Timing own = timing;
+        own.pid = (*batch)[k].client.pid;
+        if (success) {
+            for (size_t i = 0; i < request.outputs.size(); ++i) {
+                const DataLocation& location = request.outputs[i].location;
+                std::memcpy(pools[k][location.poolIndex].buffer + location.offset,
+                            staging + mStagingRequest.outputs[i].location.offset +
+                                k * mOutputSizes[i],
+                            mOutputSizes[i]);
+            }
+            syncOutputs(request.outputs, &pools[k]);
+        }
+        (*batch)[k].done(success, own);
+    }
+}
+
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_V1_0_HEXAGON_BATCHER_H
+#define ANDROID_HARDWARE_V1_0_HEXAGON_BATCHER_H
+
+#include <android/hardware/neuralnetworks/1.0/types.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "HexagonModel.h"
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+
+// Dynamic batching of single-sample requests. Requests are held for up to a
+// latency budget, stacked along the batch dimension into a staging pool, run
+// as one execution of a graph built for the whole batch, and the outputs are
+// scattered back to each request. The batched graph shares its host constants
+// with the graph of the model, which is left to be materialized only for
+// requests that cannot be batched.
+class Batcher {
+    // methods
+   private:
+    Batcher(uint32_t batchSize, std::chrono::microseconds budget,
+            const std::shared_ptr<Model>& batchedModel, const std::vector<uint32_t>& inputSizes,
+            const std::vector<uint32_t>& outputSizes);
+    Batcher(const Batcher&) = delete;
+    Batcher& operator=(const Batcher&) = delete;
+
+    struct Pending {
+        Request request;
+        Client client;
+        std::function<void(bool, const Timing&)> done;
+    };
+
+    bool initialize();
+    void batchLoop();
+    void executeBatch(std::vector<Pending>* batch);
+
+   public:
+    // Returns nullptr if batching is disabled (vendor.hvx.batch.size < 2) or
+    // if the model cannot be batched.
+    static std::unique_ptr<Batcher> create(const NeuralnetworksModel& model,
+                                           const std::shared_ptr<Model>& hexagonModel);
+    ~Batcher();
+
+    // replaces vendor.hvx.batch.size if not 0, for the tests
+    static void setBatchSizeForTesting(uint32_t batchSize) { sBatchSizeForTesting = batchSize; }
+
+    // Whether the request can be merged with others: every argument must
+    // hold exactly one sample.
+    bool accepts(const Request& request) const;
+
+    // Queues the request. done is called from the batching thread, with the
+    // DSP time of the execution the request was part of.
+    void enqueue(const Request& request, const Client& client,
+                 std::function<void(bool, const Timing&)> done);
+
+    // members
+   private:
+    const uint32_t mBatchSize;
+    const std::chrono::microseconds mBudget;
+    const std::shared_ptr<Model> mBatchedModel;
+    const std::vector<uint32_t> mInputSizes;
+    const std::vector<uint32_t> mOutputSizes;
+
+    // staging pool, holding every batched input and output
+    Request mStagingRequest;
+    MappedPools mStaging;
+
+    std::mutex mMutex;
+    std::condition_variable mQueued;
+    std::deque<std::pair<std::chrono::steady_clock::time_point, Pending>> mQueue;
+    bool mStopping;
+    std::thread mThread;
+
+    static uint32_t sBatchSizeForTesting;
+};
+
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_V1_0_HEXAGON_BATCHER_H
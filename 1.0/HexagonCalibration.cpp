@@ -0,0 +1,409 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "android.hardware.neuralnetworks@1.0-impl-hvx"
+
+#include "HexagonCalibration.h"
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+#include "HexagonDispatcher.h"
+#include "HexagonModel.h"
+#include "HexagonUtils.h"
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+
+const char Calibration::kFilename[] = "/data/vendor/hvx/calibration";
+
+namespace {
+
+// Bumped whenever the workloads or the file format change, so that stale
+// results are discarded.
+constexpr uint32_t kCalibrationVersion = 2;
+constexpr uint32_t kWarmupRuns = 2;
+constexpr uint32_t kTimedRuns = 10;
+// the workloads run behind every client execution
+const Client kCalibrationClient{.workload = WorkloadClass::BACKGROUND, .pid = 0};
+
+// These numbers are approximations, used whenever a workload cannot be
+// measured. Only execTime is measured: nothing on the host observes the
+// power drawn by the DSP, so powerUsage always keeps its approximation.
+constexpr PerformanceInfo kDefaultFloat32Performance = {
+    .execTime = 30.0f, .powerUsage = 2.0f,
+};
+constexpr PerformanceInfo kDefaultQuantized8Performance = {
+    .execTime = 0.7f, .powerUsage = 0.7f,
+};
+
+class ModelBuilder {
+   public:
+    ModelBuilder(OperandType type) : mType(type) {}
+
+    uint32_t addInput(const std::vector<uint32_t>& dims) {
+        uint32_t index = addOperand(mType, dims, OperandLifeTime::MODEL_INPUT);
+        mInputs.push_back(index);
+        return index;
+    }
+
+    uint32_t addOutput(const std::vector<uint32_t>& dims) {
+        uint32_t index = addOperand(mType, dims, OperandLifeTime::MODEL_OUTPUT);
+        mOutputs.push_back(index);
+        return index;
+    }
+
+    uint32_t addWeights(const std::vector<uint32_t>& dims) {
+        const bool quantized = mType == OperandType::TENSOR_QUANT8_ASYMM;
+        uint32_t index = addOperand(mType, dims, OperandLifeTime::CONSTANT_COPY);
+        const uint32_t count = getSize(mOperands[index]) / getSize(mType);
+        for (uint32_t i = 0; i < count; ++i) {
+            if (quantized) {
+                addValue<uint8_t>(static_cast<uint8_t>(i * 31 % 255));
+            } else {
+                addValue<float>(static_cast<float>(i * 31 % 255) / 255.0f - 0.5f);
+            }
+        }
+        return setLocation(index);
+    }
+
+    uint32_t addBias(uint32_t count) {
+        const bool quantized = mType == OperandType::TENSOR_QUANT8_ASYMM;
+        const OperandType type = quantized ? OperandType::TENSOR_INT32 : mType;
+        uint32_t index = addOperand(type, {count}, OperandLifeTime::CONSTANT_COPY);
+        mOperands[index].scale = quantized ? kScale * kScale : 0.0f;
+        mOperands[index].zeroPoint = 0;
+        for (uint32_t i = 0; i < count; ++i) {
+            if (quantized) {
+                addValue<int32_t>(static_cast<int32_t>(i % 16));
+            } else {
+                addValue<float>(static_cast<float>(i % 16) / 16.0f);
+            }
+        }
+        return setLocation(index);
+    }
+
+    uint32_t addScalar(int32_t value) {
+        uint32_t index = addOperand(OperandType::INT32, {}, OperandLifeTime::CONSTANT_COPY);
+        addValue<int32_t>(value);
+        return setLocation(index);
+    }
+
+    void addOperation(OperationType type, const std::vector<uint32_t>& inputs,
+                      const std::vector<uint32_t>& outputs) {
+        mOperations.push_back({.type = type, .inputs = inputs, .outputs = outputs});
+        for (uint32_t input : inputs) {
+            mOperands[input].numberOfConsumers++;
+        }
+    }
+
+    NeuralnetworksModel build() {
+        return {
+            .operands = mOperands,
+            .operations = mOperations,
+            .inputIndexes = mInputs,
+            .outputIndexes = mOutputs,
+            .operandValues = mValues,
+            .pools = {},
+        };
+    }
+
+   private:
+    // Outputs are requantized with twice the accumulator scale so that the
+    // requantization multiplier stays below one.
+    static constexpr float kScale = 0.5f;
+
+    uint32_t addOperand(OperandType type, const std::vector<uint32_t>& dims,
+                        OperandLifeTime lifetime) {
+        const bool quantized = type == OperandType::TENSOR_QUANT8_ASYMM;
+        const bool output = lifetime == OperandLifeTime::MODEL_OUTPUT;
+        mOperands.push_back({
+            .type = type,
+            .dimensions = dims,
+            .numberOfConsumers = 0,
+            .scale = quantized ? (output ? 2 * kScale * kScale : kScale) : 0.0f,
+            .zeroPoint = quantized ? 128 : 0,
+            .lifetime = lifetime,
+            .location = {.poolIndex = 0, .offset = 0, .length = 0},
+        });
+        return mOperands.size() - 1;
+    }
+
+    template <typename Type>
+    void addValue(Type value) {
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+        mValues.insert(mValues.end(), bytes, bytes + sizeof(Type));
+    }
+
+    uint32_t setLocation(uint32_t index) {
+        const uint32_t length = getSize(mOperands[index]);
+        mOperands[index].location = {
+            .poolIndex = 0, .offset = static_cast<uint32_t>(mValues.size()) - length,
+            .length = length,
+        };
+        return index;
+    }
+
+    const OperandType mType;
+    std::vector<Operand> mOperands;
+    std::vector<Operation> mOperations;
+    std::vector<uint32_t> mInputs;
+    std::vector<uint32_t> mOutputs;
+    std::vector<uint8_t> mValues;
+};
+
+// 3x3 convolution over a mid-network sized feature map
+NeuralnetworksModel createConvModel(OperandType type) {
+    ModelBuilder builder(type);
+    uint32_t input = builder.addInput({1, 56, 56, 32});
+    uint32_t filter = builder.addWeights({32, 3, 3, 32});
+    uint32_t bias = builder.addBias(32);
+    uint32_t padding = builder.addScalar(::android::nn::kPaddingSame);
+    uint32_t stride = builder.addScalar(1);
+    uint32_t activation = builder.addScalar(static_cast<int32_t>(FusedActivationFunc::RELU));
+    uint32_t output = builder.addOutput({1, 56, 56, 32});
+    builder.addOperation(OperationType::CONV_2D,
+                         {input, filter, bias, padding, stride, stride, activation}, {output});
+    return builder.build();
+}
+
+// 3x3 depthwise convolution, as found in mobile-friendly networks
+NeuralnetworksModel createDepthwiseConvModel(OperandType type) {
+    ModelBuilder builder(type);
+    uint32_t input = builder.addInput({1, 56, 56, 64});
+    uint32_t filter = builder.addWeights({1, 3, 3, 64});
+    uint32_t bias = builder.addBias(64);
+    uint32_t padding = builder.addScalar(::android::nn::kPaddingSame);
+    uint32_t stride = builder.addScalar(1);
+    uint32_t multiplier = builder.addScalar(1);
+    uint32_t activation = builder.addScalar(static_cast<int32_t>(FusedActivationFunc::RELU6));
+    uint32_t output = builder.addOutput({1, 56, 56, 64});
+    builder.addOperation(OperationType::DEPTHWISE_CONV_2D,
+                         {input, filter, bias, padding, stride, stride, multiplier, activation},
+                         {output});
+    return builder.build();
+}
+
+// classifier head
+NeuralnetworksModel createFullyConnectedModel(OperandType type) {
+    ModelBuilder builder(type);
+    uint32_t input = builder.addInput({1, 1024});
+    uint32_t weights = builder.addWeights({1000, 1024});
+    uint32_t bias = builder.addBias(1000);
+    uint32_t activation = builder.addScalar(static_cast<int32_t>(FusedActivationFunc::NONE));
+    uint32_t output = builder.addOutput({1, 1000});
+    builder.addOperation(OperationType::FULLY_CONNECTED, {input, weights, bias, activation},
+                         {output});
+    return builder.build();
+}
+
+using Clock = std::chrono::steady_clock;
+
+template <typename Function>
+double timeRuns(Function run) {
+    for (uint32_t i = 0; i < kWarmupRuns; ++i) {
+        if (!run()) {
+            return 0.0;
+        }
+    }
+    const Clock::time_point start = Clock::now();
+    for (uint32_t i = 0; i < kTimedRuns; ++i) {
+        if (!run()) {
+            return 0.0;
+        }
+    }
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Returns the time taken by the driver relative to the CPU, or 0 if either
+// side could not run the workload.
+double measure(const NeuralnetworksModel& model) {
+    Request request;
+    HEXAGON_SOFT_ASSERT(nn::validateModel(model), "invalid calibration model");
+    HEXAGON_SOFT_ASSERT(createScratchRequest(model, &request), "failed to create request");
+
+    // cpu reference
+    const std::vector<RunTimePoolInfo> modelPools = mapPools(model.pools);
+    const std::vector<RunTimePoolInfo> requestPools = mapPools(request.pools);
+    const double cpuTime = timeRuns([&]() {
+        nn::CpuExecutor executor;
+        return executor.run(model, request, modelPools, requestPools) == ANEURALNETWORKS_NO_ERROR;
+    });
+    HEXAGON_SOFT_ASSERT_LT(0.0, cpuTime, "cpu could not run calibration model");
+
+    // hexagon
+    hexagon::Model hexagonModel(model);
+    HEXAGON_SOFT_ASSERT(hexagonModel.prepare(), "hexagon could not prepare calibration model");
+    const double hexagonTime =
+        timeRuns([&]() { return hexagonModel.execute(request, kCalibrationClient); });
+    HEXAGON_SOFT_ASSERT_LT(0.0, hexagonTime, "hexagon could not run calibration model");
+
+    return hexagonTime / cpuTime;
+}
+
+// Geometric mean of the ratios measured over every workload of the given type.
+PerformanceInfo measure(OperandType type, const PerformanceInfo& fallback) {
+    const std::vector<NeuralnetworksModel> models = getCalibrationModels(type);
+    double logSum = 0.0;
+    for (const NeuralnetworksModel& model : models) {
+        const double ratio = measure(model);
+        if (ratio <= 0.0) {
+            LOG(INFO) << "Could not calibrate " << toString(type) << ", using defaults";
+            return fallback;
+        }
+        logSum += std::log(ratio);
+    }
+    const float execTime = static_cast<float>(std::exp(logSum / models.size()));
+    return {.execTime = execTime, .powerUsage = fallback.powerUsage};
+}
+
+}  // anonymous namespace
+
+std::vector<NeuralnetworksModel> getCalibrationModels(OperandType type) {
+    return {
+        createConvModel(type), createDepthwiseConvModel(type), createFullyConnectedModel(type),
+    };
+}
+
+NeuralnetworksModel getCanaryModel() {
+    ModelBuilder builder(OperandType::TENSOR_QUANT8_ASYMM);
+    uint32_t input = builder.addInput({1, 8, 8, 8});
+    uint32_t filter = builder.addWeights({8, 1, 1, 8});
+    uint32_t bias = builder.addBias(8);
+    uint32_t padding = builder.addScalar(::android::nn::kPaddingSame);
+    uint32_t stride = builder.addScalar(1);
+    uint32_t activation = builder.addScalar(static_cast<int32_t>(FusedActivationFunc::NONE));
+    uint32_t output = builder.addOutput({1, 8, 8, 8});
+    builder.addOperation(OperationType::CONV_2D,
+                         {input, filter, bias, padding, stride, stride, activation}, {output});
+    return builder.build();
+}
+
+Calibration::Calibration()
+    : mCapabilities({
+          .float32Performance = kDefaultFloat32Performance,
+          .quantized8Performance = kDefaultQuantized8Performance,
+      }) {}
+
+Calibration& Calibration::getInstance() {
+    static Calibration instance{};
+    return instance;
+}
+
+std::string Calibration::getKey() {
+    int version = -1;
+    int binaryVersion = -1;
+    Controller::getInstance().version(&version);
+    Controller::getInstance().GetHexagonBinaryVersion(&binaryVersion);
+    return std::to_string(kCalibrationVersion) + " " + std::to_string(version) + " " +
+           std::to_string(binaryVersion);
+}
+
+bool Calibration::load(const std::string& key, Capabilities* capabilities) {
+    std::string content;
+    if (!::android::base::ReadFileToString(kFilename, &content)) {
+        return false;
+    }
+
+    std::istringstream is(content);
+    std::string storedKey;
+    std::getline(is, storedKey);
+    is >> capabilities->float32Performance.execTime >>
+        capabilities->float32Performance.powerUsage >>
+        capabilities->quantized8Performance.execTime >>
+        capabilities->quantized8Performance.powerUsage;
+    HEXAGON_SOFT_ASSERT(!is.fail(), "Malformed calibration file " << kFilename);
+    HEXAGON_SOFT_ASSERT_EQ(key, storedKey, "Calibration is out of date");
+    return true;
+}
+
+bool Calibration::store(const std::string& key, const Capabilities& capabilities) {
+    std::ostringstream os;
+    os << key << "\n"
+       << capabilities.float32Performance.execTime << " "
+       << capabilities.float32Performance.powerUsage << "\n"
+       << capabilities.quantized8Performance.execTime << " "
+       << capabilities.quantized8Performance.powerUsage << "\n";
+
+    const std::string temporary = std::string(kFilename) + ".tmp";
+    HEXAGON_SOFT_ASSERT(::android::base::WriteStringToFile(os.str(), temporary),
+                        "Failed to write " << temporary);
+    HEXAGON_SOFT_ASSERT_EQ(0, std::rename(temporary.c_str(), kFilename),
+                           "Failed to store calibration");
+    return true;
+}
+
+void Calibration::run() {
+    if (!isHexagonAvailable()) {
+        return;
+    }
+    const std::string key = getKey();
+    Capabilities capabilities;
+    if (load(key, &capabilities)) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mCapabilities = capabilities;
+        return;
+    }
+
+    LOG(INFO) << "Calibrating hexagon performance";
+    capabilities.float32Performance =
+        measure(OperandType::TENSOR_FLOAT32, kDefaultFloat32Performance);
+    capabilities.quantized8Performance =
+        measure(OperandType::TENSOR_QUANT8_ASYMM, kDefaultQuantized8Performance);
+    LOG(INFO) << "Calibration: float32 " << capabilities.float32Performance.execTime << "/"
+              << capabilities.float32Performance.powerUsage << ", quant8 "
+              << capabilities.quantized8Performance.execTime << "/"
+              << capabilities.quantized8Performance.powerUsage;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mCapabilities = capabilities;
+    }
+
+    // don't persist results if the dsp went away while measuring
+    if (isHexagonAvailable()) {
+        store(key, capabilities);
+    }
+}
+
+void Calibration::calibrate() {
+    std::call_once(mCalibrated, [this]() { run(); });
+}
+
+void Calibration::start() {
+    // measuring may take seconds, and must not hold up the clients
+    std::call_once(mStarted, [this]() {
+        Dispatcher::getInstance().post(WorkloadClass::BACKGROUND, [this]() { calibrate(); });
+    });
+}
+
+Capabilities Calibration::getCapabilities() {
+    start();
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mCapabilities;
+}
+
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
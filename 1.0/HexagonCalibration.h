@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_V1_0_HEXAGON_CALIBRATION_H
+#define ANDROID_HARDWARE_V1_0_HEXAGON_CALIBRATION_H
+
+#include <android/hardware/neuralnetworks/1.0/types.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+
+using NeuralnetworksModel = ::android::hardware::neuralnetworks::V1_0::Model;
+
+// Representative workloads used to measure the DSP against the CPU.
+std::vector<NeuralnetworksModel> getCalibrationModels(OperandType type);
+
+// Tiny quantized workload, cheap enough to run whenever the DSP needs warming
+// up.
+NeuralnetworksModel getCanaryModel();
+
+// Measures the driver's performance relative to the CPU reference
+// implementation. The workloads run once per device and nnlib version; the
+// results are persisted and reloaded on every later boot. Until they are
+// known, the defaults are reported.
+class Calibration {
+    // methods
+   private:
+    Calibration();
+    Calibration(const Calibration&) = delete;
+    Calibration(Calibration&&) = delete;
+    Calibration& operator=(const Calibration&) = delete;
+    Calibration& operator=(Calibration&&) = delete;
+
+    std::string getKey();
+    bool load(const std::string& key, Capabilities* capabilities);
+    bool store(const std::string& key, const Capabilities& capabilities);
+    void run();
+
+   public:
+    static Calibration& getInstance();
+
+    // Never blocks: calibration is started in the background on the first
+    // call, which gets the defaults.
+    Capabilities getCapabilities();
+    // Queues the calibration on a prepare worker, at background priority,
+    // unless it was queued already. Never blocks.
+    void start();
+    // Loads the persisted calibration, or measures it. Blocks until done.
+    void calibrate();
+
+    // members
+   private:
+    static const char kFilename[];
+    std::once_flag mStarted;
+    std::once_flag mCalibrated;
+    std::mutex mMutex;
+    Capabilities mCapabilities;
+};
+
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_V1_0_HEXAGON_CALIBRATION_H
@@ -0,0 +1,531 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define LOG_TAG "android.hardware.neuralnetworks@1.0-impl-hvx"
+
+#include "HexagonCompilationCache.h"
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/properties.h>
+#include <android-base/unique_fd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <openssl/sha.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <tuple>
+#include "HexagonController.h"
+#include "HexagonUtils.h"
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+
+namespace {
+
+constexpr char kMagic[8] = {'H', 'V', 'X', 'G', 'R', 'A', 'P', 'H'};
+constexpr uint32_t kCacheVersion = 1;
+constexpr char kSuffix[] = ".hvxgraph";
+
+// file layout: FileHeader, then the payload of
+//   DimensionsRecord x (numInputs + numOutputs)
+//   TensordefRecord x (numInputs + numOutputs)
+//   numNodes x (NodeRecord, hexagon_nn_input x numInputs,
+//               hexagon_nn_output x numOutputs, data)
+// where every array is padded to 8 bytes
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    int32_t nnlibVersion;
+    int32_t binaryVersion;
+    uint32_t numInputs;
+    uint32_t numOutputs;
+    uint32_t numNodes;
+    uint8_t token[32];
+    uint64_t payloadSize;
+    uint8_t checksum[SHA256_DIGEST_LENGTH];
+};
+
+struct DimensionsRecord {
+    uint32_t rank;
+    uint32_t values[Dimensions::kMaxRank];
+};
+
+// hexagon_nn_tensordef without its data pointer
+struct TensordefRecord {
+    uint32_t batches;
+    uint32_t height;
+    uint32_t width;
+    uint32_t depth;
+    int32_t dataLen;
+    uint32_t dataValidLen;
+};
+
+struct NodeRecord {
+    uint32_t id;
+    uint32_t op;
+    uint32_t padding;
+    uint32_t numInputs;
+    uint32_t numOutputs;
+    uint32_t batches;
+    uint32_t height;
+    uint32_t width;
+    uint32_t depth;
+    uint32_t reserved;
+    uint64_t dataSize;
+};
+
+constexpr size_t kAlignment = 8;
+
+size_t align(size_t size) {
+    return (size + kAlignment - 1) & ~(kAlignment - 1);
+}
+
+class Writer {
+   public:
+    template <typename Type>
+    void write(const Type* values, size_t count) {
+        const size_t size = sizeof(Type) * count;
+        mBuffer.append(reinterpret_cast<const char*>(values), size);
+        mBuffer.append(align(size) - size, '\0');
+    }
+    const std::string& buffer() const { return mBuffer; }
+
+   private:
+    std::string mBuffer;
+};
+
+class Reader {
+   public:
+    Reader(const uint8_t* begin, const uint8_t* end) : mPosition(begin), mEnd(end) {}
+
+    // Returns nullptr if the payload is too short.
+    template <typename Type>
+    const Type* read(size_t count) {
+        const size_t size = align(sizeof(Type) * count);
+        if (count > (mEnd - mPosition) / sizeof(Type) ||
+            size > static_cast<size_t>(mEnd - mPosition)) {
+            return nullptr;
+        }
+        const Type* values = reinterpret_cast<const Type*>(mPosition);
+        mPosition += size;
+        return values;
+    }
+    bool done() const { return mPosition == mEnd; }
+
+   private:
+    const uint8_t* mPosition;
+    const uint8_t* const mEnd;
+};
+
+std::tuple<int, int> getNnlibVersions() {
+    int version = -1;
+    int binaryVersion = -1;
+    Controller::getInstance().version(&version);
+    Controller::getInstance().GetHexagonBinaryVersion(&binaryVersion);
+    return std::make_tuple(version, binaryVersion);
+}
+
+std::string getPath(const std::string& directory, const CacheToken& token) {
+    static const char kHex[] = "0123456789abcdef";
+    std::string path = directory + "/";
+    for (uint8_t byte : token) {
+        path += kHex[byte >> 4];
+        path += kHex[byte & 0xf];
+    }
+    return path + kSuffix;
+}
+
+void checksum(const void* payload, size_t size, uint8_t* digest) {
+    SHA256_CTX context;
+    SHA256_Init(&context);
+    SHA256_Update(&context, payload, size);
+    SHA256_Final(digest, &context);
+}
+
+void writeDimensions(const std::vector<Dimensions>& dimensions, Writer* writer) {
+    std::vector<DimensionsRecord> records;
+    for (const Dimensions& dims : dimensions) {
+        DimensionsRecord record{.rank = dims.rank, .values = {}};
+        std::copy(dims.begin(), dims.end(), record.values);
+        records.push_back(record);
+    }
+    writer->write(records.data(), records.size());
+}
+
+void writeTensordefs(const std::vector<hexagon_nn_tensordef>& tensordefs, Writer* writer) {
+    std::vector<TensordefRecord> records;
+    for (const hexagon_nn_tensordef& tensordef : tensordefs) {
+        records.push_back({
+            .batches = tensordef.batches,
+            .height = tensordef.height,
+            .width = tensordef.width,
+            .depth = tensordef.depth,
+            .dataLen = tensordef.dataLen,
+            .dataValidLen = tensordef.data_valid_len,
+        });
+    }
+    writer->write(records.data(), records.size());
+}
+
+bool readDimensions(Reader* reader, uint32_t count, std::vector<Dimensions>* dimensions) {
+    const DimensionsRecord* records = reader->read<DimensionsRecord>(count);
+    HEXAGON_SOFT_ASSERT(records != nullptr, "Truncated dimensions");
+    for (uint32_t i = 0; i < count; ++i) {
+        const uint32_t* values = records[i].values;
+        const uint32_t rank = std::min<uint32_t>(records[i].rank, Dimensions::kMaxRank);
+        dimensions->emplace_back(std::vector<uint32_t>(values, values + rank));
+    }
+    return true;
+}
+
+bool readTensordefs(Reader* reader, uint32_t count,
+                    std::vector<hexagon_nn_tensordef>* tensordefs) {
+    const TensordefRecord* records = reader->read<TensordefRecord>(count);
+    HEXAGON_SOFT_ASSERT(records != nullptr, "Truncated tensordefs");
+    for (uint32_t i = 0; i < count; ++i) {
+        tensordefs->push_back({
+            .batches = records[i].batches,
+            .height = records[i].height,
+            .width = records[i].width,
+            .depth = records[i].depth,
+            .data = nullptr,
+            .dataLen = records[i].dataLen,
+            .data_valid_len = records[i].dataValidLen,
+            .unused = 0,
+        });
+    }
+    return true;
+}
+
+// The constants of the nodes are left in file, the mapped cache file.
+bool readNodes(Reader* reader, uint32_t count, const std::shared_ptr<const ConstantBuffer>& file,
+               std::vector<GraphNode>* nodes) {
+    for (uint32_t i = 0; i < count; ++i) {
+        const NodeRecord* record = reader->read<NodeRecord>(1);
+        HEXAGON_SOFT_ASSERT(record != nullptr, "Truncated node " << i);
+        const hexagon_nn_input* inputs = reader->read<hexagon_nn_input>(record->numInputs);
+        const hexagon_nn_output* outputs = reader->read<hexagon_nn_output>(record->numOutputs);
+        const uint8_t* data = reader->read<uint8_t>(record->dataSize);
+        HEXAGON_SOFT_ASSERT(inputs != nullptr && outputs != nullptr && data != nullptr,
+                            "Truncated node " << i);
+        nodes->push_back({
+            .id = record->id,
+            .op = static_cast<op_type>(record->op),
+            .padding = static_cast<hexagon_nn_padding_type>(record->padding),
+            .inputs = std::vector<hexagon_nn_input>(inputs, inputs + record->numInputs),
+            .outputs = std::vector<hexagon_nn_output>(outputs, outputs + record->numOutputs),
+            .batches = record->batches,
+            .height = record->height,
+            .width = record->width,
+            .depth = record->depth,
+            .buffer = record->dataSize == 0 ? nullptr : file,
+            .offset = static_cast<size_t>(data - file->data()),
+            .size = record->dataSize,
+        });
+    }
+    return true;
+}
+
+// parses a mapped cache file, which the graph then refers to
+bool parse(const std::shared_ptr<const ConstantBuffer>& mapping, const CacheToken& token,
+           Graph* graph, std::vector<hexagon_nn_tensordef>* inputs,
+           std::vector<hexagon_nn_tensordef>* outputs, std::vector<Dimensions>* inputDimensions,
+           std::vector<Dimensions>* outputDimensions) {
+    const uint8_t* file = mapping->data();
+    const size_t size = mapping->size();
+    HEXAGON_SOFT_ASSERT_LE(sizeof(FileHeader), size, "Truncated cache file");
+    const FileHeader& header = *reinterpret_cast<const FileHeader*>(file);
+    HEXAGON_SOFT_ASSERT(std::equal(kMagic, kMagic + sizeof(kMagic), header.magic),
+                        "Not a cache file");
+    HEXAGON_SOFT_ASSERT_EQ(kCacheVersion, header.version, "Cache format is out of date");
+    HEXAGON_SOFT_ASSERT(std::make_tuple(header.nnlibVersion, header.binaryVersion) ==
+                            getNnlibVersions(),
+                        "Cache entry is from another nnlib");
+    HEXAGON_SOFT_ASSERT(std::equal(token.begin(), token.end(), header.token),
+                        "Cache entry is for another token");
+    HEXAGON_SOFT_ASSERT_EQ(size - sizeof(FileHeader), header.payloadSize, "Truncated cache file");
+
+    uint8_t digest[SHA256_DIGEST_LENGTH];
+    checksum(file + sizeof(FileHeader), header.payloadSize, digest);
+    HEXAGON_SOFT_ASSERT(std::equal(digest, digest + sizeof(digest), header.checksum),
+                        "Cache entry is corrupted");
+
+    const uint8_t* begin = file + sizeof(FileHeader);
+    Reader reader(begin, begin + header.payloadSize);
+    std::vector<GraphNode> nodes;
+    HEXAGON_SOFT_ASSERT(readDimensions(&reader, header.numInputs, inputDimensions) &&
+                            readDimensions(&reader, header.numOutputs, outputDimensions) &&
+                            readTensordefs(&reader, header.numInputs, inputs) &&
+                            readTensordefs(&reader, header.numOutputs, outputs) &&
+                            readNodes(&reader, header.numNodes, mapping, &nodes) &&
+                            reader.done(),
+                        "Malformed cache entry");
+    *graph = Graph(std::move(nodes));
+    return true;
+}
+
+}  // anonymous namespace
+
+CompilationCache::CompilationCache()
+    : mRoot(::android::base::GetProperty("vendor.hvx.cache.root", "/data/vendor/hvx/cache")),
+      mDefaultDirectory(::android::base::GetProperty("vendor.hvx.cache.dir", "")),
+      mMaxBytes(::android::base::GetUintProperty<uint64_t>("vendor.hvx.cache.max_mb", 64) << 20),
+      mHits(0),
+      mMisses(0),
+      mStores(0) {}
+
+CompilationCache& CompilationCache::getInstance() {
+    static CompilationCache instance{};
+    return instance;
+}
+
+bool CompilationCache::isOwned(const std::string& directory) const {
+    // the root itself, or a directory under it named without . or ..
+    if (directory.compare(0, mRoot.size(), mRoot) != 0) {
+        return false;
+    }
+    const std::string relative = directory.substr(mRoot.size());
+    if (!relative.empty() && relative[0] != '/') {
+        return false;
+    }
+    for (size_t begin = 1; begin < relative.size();) {
+        const size_t end = std::min(relative.find('/', begin), relative.size());
+        const std::string component = relative.substr(begin, end - begin);
+        if (component.empty() || component == "." || component == "..") {
+            return false;
+        }
+        begin = end + 1;
+    }
+
+    // nor reached through a link out of the root; a directory yet to be
+    // created is checked by its parent
+    if (relative.empty()) {
+        return true;
+    }
+    char resolved[PATH_MAX];
+    if (realpath(directory.c_str(), resolved) == nullptr) {
+        const std::string parent = directory.substr(0, directory.rfind('/'));
+        if (errno != ENOENT || realpath(parent.c_str(), resolved) == nullptr) {
+            return parent == mRoot && errno == ENOENT;
+        }
+    }
+    const std::string real = resolved;
+    return real == mRoot || real.compare(0, mRoot.size() + 1, mRoot + "/") == 0;
+}
+
+CacheToken CompilationCache::getToken(const NeuralnetworksModel& model) {
+    SHA256_CTX context;
+    SHA256_Init(&context);
+    auto update = [&context](const void* data, size_t size) {
+        SHA256_Update(&context, data, size);
+    };
+    auto updateVector = [&update](const auto& values) {
+        const uint64_t size = values.size();
+        update(&size, sizeof(size));
+        update(values.data(), values.size() * sizeof(values[0]));
+    };
+
+    update(&kCacheVersion, sizeof(kCacheVersion));
+    for (const Operand& operand : model.operands) {
+        update(&operand.type, sizeof(operand.type));
+        updateVector(operand.dimensions);
+        update(&operand.scale, sizeof(operand.scale));
+        update(&operand.zeroPoint, sizeof(operand.zeroPoint));
+        update(&operand.lifetime, sizeof(operand.lifetime));
+        update(&operand.location, sizeof(operand.location));
+    }
+    for (const Operation& operation : model.operations) {
+        update(&operation.type, sizeof(operation.type));
+        updateVector(operation.inputs);
+        updateVector(operation.outputs);
+    }
+    updateVector(model.inputIndexes);
+    updateVector(model.outputIndexes);
+    updateVector(model.operandValues);
+    for (const RunTimePoolInfo& pool : mapPools(model.pools)) {
+        update(pool.buffer, pool.hidlMemory.size());
+    }
+
+    CacheToken token;
+    SHA256_Final(token.data(), &context);
+    return token;
+}
+
+bool CompilationCache::load(const std::string& directory, const CacheToken& token,
+                            Entry* entry) {
+    if (!isOwned(directory)) {
+        LOG(ERROR) << directory << " is not a cache directory";
+        ++mMisses;
+        return false;
+    }
+    const std::string path = getPath(directory, token);
+    ::android::base::unique_fd fd(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    struct stat status;
+    if (!fd.ok() || fstat(fd.get(), &status) != 0 || status.st_size == 0) {
+        ++mMisses;
+        return false;
+    }
+
+    // the restored graph reads its constants straight from the mapping
+    const size_t size = status.st_size;
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd.get(), 0);
+    if (mapping == MAP_FAILED) {
+        PLOG(ERROR) << "Failed to map " << path;
+        ++mMisses;
+        return false;
+    }
+    Graph graph;
+    std::vector<hexagon_nn_tensordef> inputs;
+    std::vector<hexagon_nn_tensordef> outputs;
+    if (!parse(std::make_shared<ConstantBuffer>(mapping, size), token, &graph, &inputs, &outputs,
+               &entry->inputs, &entry->outputs)) {
+        // replaced by the next store
+        unlink(path.c_str());
+        ++mMisses;
+        return false;
+    }
+
+    entry->model = Model::restore(std::move(graph), std::move(inputs), std::move(outputs));
+    if (entry->model == nullptr) {
+        ++mMisses;
+        return false;
+    }
+
+    // keeps the entry from being trimmed first
+    utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+    ++mHits;
+    LOG(INFO) << "Restored model from " << path;
+    return true;
+}
+
+bool CompilationCache::store(const std::string& directory, const CacheToken& token,
+                             const Model& model, const RequestValidator& validator) {
+    const std::vector<GraphNode>& nodes = model.getRecipe().getNodes();
+
+    Writer writer;
+    writeDimensions(validator.getInputs(), &writer);
+    writeDimensions(validator.getOutputs(), &writer);
+    writeTensordefs(model.getInputTemplates(), &writer);
+    writeTensordefs(model.getOutputTemplates(), &writer);
+    for (const GraphNode& node : nodes) {
+        const NodeRecord record{
+            .id = node.id,
+            .op = static_cast<uint32_t>(node.op),
+            .padding = static_cast<uint32_t>(node.padding),
+            .numInputs = static_cast<uint32_t>(node.inputs.size()),
+            .numOutputs = static_cast<uint32_t>(node.outputs.size()),
+            .batches = node.batches,
+            .height = node.height,
+            .width = node.width,
+            .depth = node.depth,
+            .reserved = 0,
+            .dataSize = node.size,
+        };
+        writer.write(&record, 1);
+        writer.write(node.inputs.data(), node.inputs.size());
+        writer.write(node.outputs.data(), node.outputs.size());
+        writer.write(node.getData(), node.size);
+    }
+
+    FileHeader header{};
+    std::copy(kMagic, kMagic + sizeof(kMagic), header.magic);
+    header.version = kCacheVersion;
+    std::tie(header.nnlibVersion, header.binaryVersion) = getNnlibVersions();
+    header.numInputs = validator.getInputs().size();
+    header.numOutputs = validator.getOutputs().size();
+    header.numNodes = nodes.size();
+    std::copy(token.begin(), token.end(), header.token);
+    header.payloadSize = writer.buffer().size();
+    checksum(writer.buffer().data(), writer.buffer().size(), header.checksum);
+
+    std::lock_guard<std::mutex> lock(mStoreMutex);
+    HEXAGON_SOFT_ASSERT(isOwned(directory), directory << " is not a cache directory");
+    if (mkdir(directory.c_str(), 0770) != 0 && errno != EEXIST) {
+        PLOG(ERROR) << "Failed to create " << directory;
+        return false;
+    }
+    const std::string path = getPath(directory, token);
+    const std::string temporary = path + ".tmp";
+    HEXAGON_SOFT_ASSERT(
+        ::android::base::WriteStringToFile(
+            std::string(reinterpret_cast<const char*>(&header), sizeof(header)) + writer.buffer(),
+            temporary),
+        "Failed to write " << temporary);
+    HEXAGON_SOFT_ASSERT_EQ(0, std::rename(temporary.c_str(), path.c_str()),
+                           "Failed to store " << path);
+    ++mStores;
+
+    trim(directory);
+    return true;
+}
+
+void CompilationCache::trim(const std::string& directory) {
+    std::unique_ptr<DIR, int (*)(DIR*)> dir(opendir(directory.c_str()), closedir);
+    if (dir == nullptr) {
+        return;
+    }
+
+    // (last use, size, path)
+    std::vector<std::tuple<time_t, uint64_t, std::string>> entries;
+    uint64_t total = 0;
+    const std::string suffix = kSuffix;
+    while (const dirent* file = readdir(dir.get())) {
+        const std::string name = file->d_name;
+        struct stat status;
+        if (name.size() <= suffix.size() ||
+            name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0 ||
+            stat((directory + "/" + name).c_str(), &status) != 0) {
+            continue;
+        }
+        entries.emplace_back(status.st_mtime, status.st_size, directory + "/" + name);
+        total += status.st_size;
+    }
+
+    std::sort(entries.begin(), entries.end());
+    for (const auto& entry : entries) {
+        if (total <= mMaxBytes) {
+            break;
+        }
+        unlink(std::get<2>(entry).c_str());
+        total -= std::get<1>(entry);
+    }
+}
+
+std::string CompilationCache::dump() {
+    return "compilation cache:\n  root: " + mRoot + "\n  directory: " +
+           (mDefaultDirectory.empty() ? std::string("disabled") : mDefaultDirectory) +
+           "\n  hits: " + std::to_string(mHits) + "\n  misses: " + std::to_string(mMisses) +
+           "\n  stores: " + std::to_string(mStores) + "\n";
+}
+
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
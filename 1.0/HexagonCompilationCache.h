@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef ANDROID_HARDWARE_V1_0_HEXAGON_COMPILATION_CACHE_H
+#define ANDROID_HARDWARE_V1_0_HEXAGON_COMPILATION_CACHE_H
+
+#include <android/hardware/neuralnetworks/1.0/types.h>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "HexagonModel.h"
+#include "HexagonRequestValidator.h"
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+
+// identifies a model in the cache
+using CacheToken = std::array<uint8_t, 32>;
+
+// Persists lowered graphs, so that preparing a model seen before rebuilds its
+// nnlib graph directly from the file: the NNAPI model is not parsed, and the
+// operation checks and lowering do not run. Entries live in a cache directory
+// under a client-provided token, or, if enabled, under a hash of the model
+// content for clients that have no token. A restored graph reads its
+// constants from the mapped entry.
+//
+// An entry is one file, valid for one cache format and one nnlib version. It
+// holds the lowered nodes, their constants (after any transposes done by
+// lowering), and the shapes and tensordefs of the model inputs and outputs.
+// Every record is 8-byte aligned, so a mapped file is read in place, and a
+// SHA-256 over the payload guards against torn or corrupted files.
+class CompilationCache {
+    // methods
+   private:
+    CompilationCache();
+    ~CompilationCache() = default;
+    CompilationCache(const CompilationCache&) = delete;
+    CompilationCache(CompilationCache&&) = delete;
+    CompilationCache& operator=(const CompilationCache&) = delete;
+    CompilationCache& operator=(CompilationCache&&) = delete;
+
+    void trim(const std::string& directory);
+
+   public:
+    static CompilationCache& getInstance();
+
+    // Directory used for clients without a token (vendor.hvx.cache.dir).
+    // Caching those is opt-in: it is empty, disabling it, unless set.
+    const std::string& getDefaultDirectory() const { return mDefaultDirectory; }
+
+    // directory the HAL owns (vendor.hvx.cache.root)
+    const std::string& getRoot() const { return mRoot; }
+
+    // Whether directory is the cache root the HAL owns
+    // (vendor.hvx.cache.root) or a directory under it. No other directory is
+    // read or written.
+    bool isOwned(const std::string& directory) const;
+
+    // token derived from everything that goes into the lowering of model
+    static CacheToken getToken(const NeuralnetworksModel& model);
+
+    struct Entry {
+        std::shared_ptr<Model> model;
+        std::vector<Dimensions> inputs;
+        std::vector<Dimensions> outputs;
+    };
+
+    // Restores the model stored under token. Returns false on a miss, or if
+    // the entry is stale or corrupted.
+    bool load(const std::string& directory, const CacheToken& token, Entry* entry);
+
+    // Stores a prepared model under token.
+    bool store(const std::string& directory, const CacheToken& token, const Model& model,
+               const RequestValidator& validator);
+
+    std::string dump();
+
+    // members
+   private:
+    const std::string mRoot;
+    const std::string mDefaultDirectory;
+    const uint64_t mMaxBytes;
+
+    // serializes stores and trimming
+    std::mutex mStoreMutex;
+
+    std::atomic<uint32_t> mHits;
+    std::atomic<uint32_t> mMisses;
+    std::atomic<uint32_t> mStores;
+};
+
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_V1_0_HEXAGON_COMPILATION_CACHE_H
@@ -49,14 +49,26 @@
     MACRO(boost)                   \
     MACRO(slow)
 
-#define CONTROLLER_CHECK(function, ...)    \
-    if (mFn_##function == nullptr) {       \
-        return -1;                         \
-    }                                      \
-    int err = mFn_##function(__VA_ARGS__); \
-    if (err != 0) {                        \
-        return err;                        \
-    }                                      \
+#define CONTROLLER_CHECK(function, ...)                \
+    Call call(this);                                   \
+    if (call.isStale() || mFn_##function == nullptr) { \
+        return -1;                                     \
+    }                                                  \
+    int err = mFn_##function(__VA_ARGS__);             \
+    if (err != 0) {                                    \
+        return err;                                    \
+    }                                                  \
+    return 0;
+
+#define CONTROLLER_CHECK_GRAPH(id, function, ...)      \
+    Call call(this, id);                               \
+    if (call.isStale() || mFn_##function == nullptr) { \
+        return -1;                                     \
+    }                                                  \
+    int err = mFn_##function(__VA_ARGS__);             \
+    if (err != 0) {                                    \
+        return err;                                    \
+    }                                                  \
     return 0;
 
 namespace android {
@@ -67,8 +79,13 @@ namespace implementation {
 namespace hexagon {
 
 const char Controller::kFilename[] = "libhexagon_nn_controller.so";
+const char* Controller::sFilename = Controller::kFilename;
+
+// How long a reset waits for the calls in flight. A call still running after
+// that is hung, and fails the reset.
+static constexpr std::chrono::milliseconds kResetDrainTimeout(500);
 
-Controller::Controller() {
+Controller::Controller() : mGeneration(0), mResetting(false), mHung(false), mActiveCalls(0) {
     openNnlib();
 }
 
@@ -77,9 +94,9 @@ Controller::~Controller() {
 }
 
 bool Controller::openNnlib() {
-    mHandle = dlopen(kFilename, RTLD_LAZY | RTLD_LOCAL);
+    mHandle = dlopen(sFilename, RTLD_LAZY | RTLD_LOCAL);
     HEXAGON_SOFT_ASSERT_NE(mHandle, 0,
-                           "FAILED TO LOAD LIBRARY " /* << kFilename << ": " << dlerror()*/);
+                           "FAILED TO LOAD LIBRARY " /* << sFilename << ": " << dlerror()*/);
     FOR_EACH_FUNCTION(LOAD_HEXAGON_FUNCTION)
     return true;
 }
@@ -89,13 +106,80 @@ bool Controller::closeNnlib() {
     if (mHandle != nullptr) {
         int err = dlclose(mHandle);
         mHandle = nullptr;
-        HEXAGON_SOFT_ASSERT_EQ(err, 0, "FAILED TO CLOSE LIBRARY " << kFilename);
+        HEXAGON_SOFT_ASSERT_EQ(err, 0, "FAILED TO CLOSE LIBRARY " << sFilename);
     }
     return true;
 }
 
 bool Controller::resetNnlib() {
-    return closeNnlib() && openNnlib();
+    std::unique_lock<std::mutex> lock(mGateMutex);
+    mGateCondition.wait(lock, [this]() { return !mResetting; });
+    mResetting = true;
+    const bool drained = mGateCondition.wait_for(lock, kResetDrainTimeout,
+                                                 [this]() { return mActiveCalls == 0; });
+
+    bool success = false;
+    if (drained) {
+        ++mGeneration;
+        mGraphLocks.clear();
+        mHung = false;
+        success = closeNnlib() && openNnlib();
+    } else {
+        // Unloading would unmap the code the calls still in flight run in,
+        // and reopening the library only takes a reference to the same
+        // instance, so the graphs built in it are all still there.
+        LOG(ERROR) << "Cannot reset nnlib with " << mActiveCalls << " calls still in flight";
+        mHung = true;
+    }
+
+    mResetting = false;
+    lock.unlock();
+    mGateCondition.notify_all();
+    return success;
+}
+
+bool Controller::isHung() {
+    std::lock_guard<std::mutex> lock(mGateMutex);
+    return mHung;
+}
+
+Controller::Call::Call(Controller* controller, hexagon_nn_nn_id id) : mController(controller) {
+    std::unique_lock<std::mutex> lock(mController->mGateMutex);
+    mController->mGateCondition.wait(lock, [this]() { return !mController->mResetting; });
+    mGeneration = mController->mGeneration;
+    ++mController->mActiveCalls;
+    if (id != hexagon_nn_nn_id{}) {
+        std::shared_ptr<std::mutex>& graphLock = mController->mGraphLocks[id];
+        if (graphLock == nullptr) {
+            graphLock = std::make_shared<std::mutex>();
+        }
+        mGraphLock = graphLock;
+    }
+    lock.unlock();
+
+    if (mGraphLock != nullptr) {
+        mGraphLock->lock();
+    }
+}
+
+bool Controller::Call::isStale() const {
+    // nnlib was reset since the call was let through the gate
+    return mGeneration != mController->mGeneration;
+}
+
+Controller::Call::~Call() {
+    if (mGraphLock != nullptr) {
+        mGraphLock->unlock();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mController->mGateMutex);
+        // the call a reset gave up on has returned after all
+        if (--mController->mActiveCalls == 0) {
+            mController->mHung = false;
+        }
+    }
+    mController->mGateCondition.notify_all();
 }
 
 Controller& Controller::getInstance() {
@@ -103,43 +187,51 @@ Controller& Controller::getInstance() {
     return instance;
 }
 
-int Controller::init(hexagon_nn_nn_id* g) {
-    CONTROLLER_CHECK(init, g);
+int Controller::init(hexagon_nn_nn_id* g, uint64_t* generation) {
+    Call call(this);
+    if (call.isStale() || mFn_init == nullptr) {
+        return -1;
+    }
+    if (generation != nullptr) {
+        *generation = mGeneration;
+    }
+    return mFn_init(g);
 }
 
 int Controller::getlog(hexagon_nn_nn_id id, unsigned char* buf, uint32_t length) {
-    CONTROLLER_CHECK(getlog, id, buf, length);
+    CONTROLLER_CHECK_GRAPH(id, getlog, id, buf, length);
 }
 
 int Controller::snpprint(hexagon_nn_nn_id id, unsigned char* buf, uint32_t length) {
-    CONTROLLER_CHECK(snpprint, id, buf, length);
+    CONTROLLER_CHECK_GRAPH(id, snpprint, id, buf, length);
 }
 
 int Controller::set_debug_level(hexagon_nn_nn_id id, int level) {
-    CONTROLLER_CHECK(set_debug_level, id, level);
+    CONTROLLER_CHECK_GRAPH(id, set_debug_level, id, level);
 }
 
 int Controller::prepare(hexagon_nn_nn_id id) {
-    CONTROLLER_CHECK(prepare, id);
+    CONTROLLER_CHECK_GRAPH(id, prepare, id);
 }
 
 int Controller::append_node(hexagon_nn_nn_id id, uint32_t node_id, op_type operation,
                             hexagon_nn_padding_type padding, const hexagon_nn_input* inputs,
                             uint32_t num_inputs, const hexagon_nn_output* outputs,
                             uint32_t num_outputs) {
-    CONTROLLER_CHECK(append_node, id, node_id, operation, padding, inputs, num_inputs, outputs,
-                     num_outputs);
+    CONTROLLER_CHECK_GRAPH(id, append_node, id, node_id, operation, padding, inputs, num_inputs,
+                           outputs, num_outputs);
 }
 
 int Controller::append_const_node(hexagon_nn_nn_id id, uint32_t node_id, uint32_t batches,
                                   uint32_t height, uint32_t width, uint32_t depth,
                                   const uint8_t* data, uint32_t data_len) {
-    CONTROLLER_CHECK(append_const_node, id, node_id, batches, height, width, depth, data, data_len);
+    CONTROLLER_CHECK_GRAPH(id, append_const_node, id, node_id, batches, height, width, depth, data,
+                           data_len);
 }
 
 int Controller::execute_new(hexagon_nn_nn_id id, const hexagon_nn_tensordef* inputs,
                             uint32_t n_inputs, hexagon_nn_tensordef* outputs, uint32_t n_outputs) {
-    CONTROLLER_CHECK(execute_new, id, inputs, n_inputs, outputs, n_outputs);
+    CONTROLLER_CHECK_GRAPH(id, execute_new, id, inputs, n_inputs, outputs, n_outputs);
 }
 
 int Controller::execute(hexagon_nn_nn_id id, uint32_t batches_in, uint32_t height_in,
@@ -147,22 +239,31 @@ int Controller::execute(hexagon_nn_nn_id id, uint32_t batches_in, uint32_t heigh
                         uint32_t data_len_in, uint32_t* batches_out, uint32_t* height_out,
                         uint32_t* width_out, uint32_t* depth_out, uint8_t* data_out,
                         uint32_t data_out_max, uint32_t* data_out_size) {
-    CONTROLLER_CHECK(execute, id, batches_in, height_in, width_in, depth_in, data_in, data_len_in,
-                     batches_out, height_out, width_out, depth_out, data_out, data_out_max,
-                     data_out_size);
+    CONTROLLER_CHECK_GRAPH(id, execute, id, batches_in, height_in, width_in, depth_in, data_in,
+                           data_len_in, batches_out, height_out, width_out, depth_out, data_out,
+                           data_out_max, data_out_size);
 }
 
-int Controller::teardown(hexagon_nn_nn_id id) {
-    CONTROLLER_CHECK(teardown, id);
+int Controller::teardown(hexagon_nn_nn_id id, uint64_t generation) {
+    Call call(this, id);
+    if (call.isStale() || generation != mGeneration || mFn_teardown == nullptr) {
+        return -1;
+    }
+    const int err = mFn_teardown(id);
+
+    // the id may be handed out again by init
+    std::lock_guard<std::mutex> lock(mGateMutex);
+    mGraphLocks.erase(id);
+    return err;
 }
 
 int Controller::get_perfinfo(hexagon_nn_nn_id id, hexagon_nn_perfinfo* info_out,
                              unsigned int info_out_len, unsigned int* n_items_out) {
-    CONTROLLER_CHECK(get_perfinfo, id, info_out, info_out_len, n_items_out);
+    CONTROLLER_CHECK_GRAPH(id, get_perfinfo, id, info_out, info_out_len, n_items_out);
 }
 
 int Controller::reset_perfinfo(hexagon_nn_nn_id id, uint32_t event) {
-    CONTROLLER_CHECK(reset_perfinfo, id, event);
+    CONTROLLER_CHECK_GRAPH(id, reset_perfinfo, id, event);
 }
 
 int Controller::version(int* ver) {
@@ -171,7 +272,7 @@ int Controller::version(int* ver) {
 
 int Controller::last_execution_cycles(hexagon_nn_nn_id id, unsigned int* cycles_lo,
                                       unsigned int* cycles_hi) {
-    CONTROLLER_CHECK(last_execution_cycles, id, cycles_lo, cycles_hi);
+    CONTROLLER_CHECK_GRAPH(id, last_execution_cycles, id, cycles_lo, cycles_hi);
 }
 
 int Controller::GetHexagonBinaryVersion(int* ver) {
@@ -18,6 +18,11 @@
 #define ANDROID_HARDWARE_V1_0_HEXAGON_CONTROLLER_H
 
 #include <android-base/logging.h>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
 #include "HexagonUtils.h"
 #include "dlfcn.h"
 #include "hexagon_nn_controller/hexagon_nn_controller.h"
@@ -52,11 +57,44 @@ class Controller {
     bool openNnlib();
     bool closeNnlib();
 
+    // Every call into nnlib is made within a Call. Calls run concurrently,
+    // except that calls on the same graph are serialized, and that a reset
+    // waits for the calls in flight and holds off new ones.
+    class Call {
+       public:
+        Call(Controller* controller, hexagon_nn_nn_id id = 0);
+        ~Call();
+        Call(const Call&) = delete;
+        Call& operator=(const Call&) = delete;
+
+        bool isStale() const;
+
+       private:
+        Controller* mController;
+        uint64_t mGeneration;
+        std::shared_ptr<std::mutex> mGraphLock;
+    };
+
    public:
     static Controller& getInstance();
+    // Unloads and reloads nnlib once the calls in flight have returned.
+    // Fails, leaving nnlib and every graph in place, if a call is still
+    // running after the drain timeout, as the library cannot be unloaded
+    // from under it.
     bool resetNnlib();
+    // whether a reset failed on a call that has not returned since
+    bool isHung();
+
+    // Loads filename in place of the nnlib controller, for tests. Must be
+    // called before the first getInstance.
+    static void setFilenameForTesting(const char* filename) { sFilename = filename; }
+
+    // Incremented by every reset. Graph ids from an older generation are
+    // dead and must not be used anymore.
+    uint64_t getGeneration() const { return mGeneration; }
 
-    int init(hexagon_nn_nn_id* g);
+    // generation, if given, receives the generation the graph belongs to
+    int init(hexagon_nn_nn_id* g, uint64_t* generation = nullptr);
 
     int getlog(hexagon_nn_nn_id id, unsigned char* buf, uint32_t length);
 
@@ -82,7 +120,9 @@ class Controller {
                 uint32_t* depth_out, uint8_t* data_out, uint32_t data_out_max,
                 uint32_t* data_out_size);
 
-    int teardown(hexagon_nn_nn_id id);
+    // Fails, leaving the graph alone, if nnlib was reset since generation,
+    // as init may have handed out id again.
+    int teardown(hexagon_nn_nn_id id, uint64_t generation);
 
     int get_perfinfo(hexagon_nn_nn_id id, hexagon_nn_perfinfo* info_out, unsigned int info_out_len,
                      unsigned int* n_items_out);
@@ -117,6 +157,14 @@ class Controller {
     // members
    private:
     static const char kFilename[];
+    static const char* sFilename;
+    std::atomic<uint64_t> mGeneration;
+    std::mutex mGateMutex;
+    std::condition_variable mGateCondition;
+    bool mResetting;
+    bool mHung;
+    uint32_t mActiveCalls;
+    std::map<hexagon_nn_nn_id, std::shared_ptr<std::mutex>> mGraphLocks;
     void* mHandle;
     hexagon_nn_controller_init_fn mFn_init;
     hexagon_nn_controller_getlog_fn mFn_getlog;
@@ -0,0 +1,389 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define LOG_TAG "android.hardware.neuralnetworks@1.0-impl-hvx"
+
+#include "HexagonDispatcher.h"
+#include <android-base/logging.h>
+#include <android-base/properties.h>
+#include <hwbinder/IPCThreadState.h>
+#include <algorithm>
+#include <fstream>
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+
+namespace {
+
+// executions per adaptation window
+constexpr uint32_t kWindowExecutions = 32;
+
+// relative throughput change below which a step of the limit is considered
+// to have made no difference
+constexpr double kTolerance = 0.05;
+
+// finish tags of idle clients are dropped beyond this many clients per class,
+// and stale workload classes beyond this many clients
+constexpr size_t kMaxTrackedClients = 64;
+
+// waiting executions per class that fit in the queues without growing them
+constexpr size_t kQueueReserve = 64;
+
+bool parseWorkloadClass(const std::string& name, WorkloadClass* workload) {
+    for (size_t i = 0; i < kNumWorkloadClasses; ++i) {
+        if (name == toString(static_cast<WorkloadClass>(i))) {
+            *workload = static_cast<WorkloadClass>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string getProcessName(pid_t pid) {
+    std::ifstream cmdline("/proc/" + std::to_string(pid) + "/cmdline");
+    std::string name;
+    std::getline(cmdline, name, '\0');
+    return name;
+}
+
+WorkloadClass getCpusetClass(pid_t pid) {
+    std::ifstream cgroup("/proc/" + std::to_string(pid) + "/cgroup");
+    std::string line;
+    while (std::getline(cgroup, line)) {
+        // <id>:<controllers>:<path>
+        const size_t controllers = line.find(':');
+        const size_t path = line.find(':', controllers + 1);
+        if (controllers == std::string::npos || path == std::string::npos ||
+            line.compare(controllers + 1, path - controllers - 1, "cpuset") != 0) {
+            continue;
+        }
+        const std::string group = line.substr(path + 1);
+        if (group == "/top-app") {
+            return WorkloadClass::INTERACTIVE;
+        }
+        if (group == "/background" || group == "/system-background") {
+            return WorkloadClass::BACKGROUND;
+        }
+        break;
+    }
+    return WorkloadClass::NORMAL;
+}
+
+WorkloadClass classify(pid_t pid) {
+    const std::string name = getProcessName(pid);
+    const std::string explicitClass =
+        name.empty() ? ""
+                     : ::android::base::GetProperty("persist.vendor.hvx.priority." + name, "");
+    WorkloadClass workload;
+    return parseWorkloadClass(explicitClass, &workload) ? workload : getCpusetClass(pid);
+}
+
+}  // anonymous namespace
+
+Client getCallingClient() {
+    Client client;
+    client.pid = ::android::hardware::IPCThreadState::self()->getCallingPid();
+    client.workload = Dispatcher::getInstance().getWorkloadClass(client.pid);
+    return client;
+}
+
+WorkerPool::WorkerPool(const char* name, uint32_t maxWorkers)
+    : mName(name), mMaxWorkers(std::max<uint32_t>(1, maxWorkers)), mIdleWorkers(0),
+      mStopping(false) {}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mQueued.notify_all();
+    for (std::thread& worker : mWorkers) {
+        worker.join();
+    }
+}
+
+void WorkerPool::workerLoop() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (true) {
+        ++mIdleWorkers;
+        auto next = mJobs.end();
+        mQueued.wait(lock, [this, &next]() {
+            next = std::find_if(mJobs.begin(), mJobs.end(),
+                                [](const auto& jobs) { return !jobs.empty(); });
+            return mStopping || next != mJobs.end();
+        });
+        --mIdleWorkers;
+        if (mStopping) {
+            return;
+        }
+
+        std::function<void()> job = std::move(next->front());
+        next->pop_front();
+        lock.unlock();
+
+        job();
+        job = nullptr;
+
+        lock.lock();
+    }
+}
+
+void WorkerPool::post(WorkloadClass workload, std::function<void()> job) {
+    const size_t index = std::min(static_cast<size_t>(workload), kNumWorkloadClasses - 1);
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mJobs[index].push_back(std::move(job));
+        // the idle workers may not have woken up for earlier jobs yet
+        if (getQueuedLocked() > mIdleWorkers && mWorkers.size() < mMaxWorkers) {
+            LOG(VERBOSE) << "Starting " << mName << " worker " << mWorkers.size();
+            mWorkers.emplace_back([this]() { workerLoop(); });
+        }
+    }
+    mQueued.notify_one();
+}
+
+size_t WorkerPool::getQueued() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return getQueuedLocked();
+}
+
+size_t WorkerPool::getQueuedLocked() const {
+    size_t queued = 0;
+    for (const std::deque<std::function<void()>>& jobs : mJobs) {
+        queued += jobs.size();
+    }
+    return queued;
+}
+
+Dispatcher::Dispatcher()
+    : mMaxInFlight(std::max<uint32_t>(
+          1, ::android::base::GetUintProperty<uint32_t>("vendor.hvx.threads.dispatch", 4))),
+      mAdaptive(::android::base::GetBoolProperty("vendor.hvx.threads.adaptive", true)),
+      mClassRefresh(::android::base::GetUintProperty<uint32_t>(
+          "vendor.hvx.priority.refresh_ms", 5000)),
+      mLimit(mMaxInFlight),
+      mPinned(false),
+      mInFlight(0),
+      mVirtualTime{},
+      mArrivals(0),
+      mWindowStart(Clock::now()),
+      mCompleted(0),
+      mContended(false),
+      mLastThroughput(0),
+      mStep(-1),
+      mExecutions{},
+      mWaits{},
+      mPreparePool("prepare",
+                   ::android::base::GetUintProperty<uint32_t>("vendor.hvx.threads.prepare", 2)),
+      mExecutePool("execute", ::android::base::GetUintProperty<uint32_t>(
+                                  "vendor.hvx.threads.execute", 2 * mMaxInFlight)) {
+    for (std::vector<QueueEntry>& queue : mQueues) {
+        queue.reserve(kQueueReserve);
+    }
+}
+
+Dispatcher& Dispatcher::getInstance() {
+    static Dispatcher instance{};
+    return instance;
+}
+
+void Dispatcher::post(std::function<void()> preparation) {
+    mPreparePool.post(WorkloadClass::NORMAL, std::move(preparation));
+}
+
+void Dispatcher::post(WorkloadClass workload, std::function<void()> job) {
+    mPreparePool.post(workload, std::move(job));
+}
+
+void Dispatcher::post(const Client& client, std::function<void()> execution) {
+    mExecutePool.post(client.workload, std::move(execution));
+}
+
+WorkloadClass Dispatcher::getWorkloadClass(pid_t pid) {
+    const Clock::time_point now = Clock::now();
+    WorkloadClass workload = WorkloadClass::NORMAL;
+    {
+        std::lock_guard<std::mutex> lock(mClientMutex);
+        auto known = mClients.find(pid);
+        if (known != mClients.end()) {
+            workload = known->second.workload;
+            if (known->second.refreshing || now - known->second.refreshed < mClassRefresh) {
+                return workload;
+            }
+            known->second.refreshing = true;
+        } else {
+            if (mClients.size() >= kMaxTrackedClients) {
+                for (auto it = mClients.begin(); it != mClients.end();) {
+                    it = !it->second.refreshing && now - it->second.refreshed >= mClassRefresh
+                             ? mClients.erase(it)
+                             : std::next(it);
+                }
+            }
+            mClients[pid] = {.workload = workload, .refreshed = now, .refreshing = true};
+        }
+    }
+
+    // Reading /proc and the properties is left to a worker, ahead of queued
+    // preparations. Until it is done, the client keeps its previous class, or
+    // is normal if it is new.
+    mPreparePool.post(WorkloadClass::INTERACTIVE, [this, pid]() {
+        const WorkloadClass workload = classify(pid);
+        std::lock_guard<std::mutex> lock(mClientMutex);
+        mClients[pid] = {.workload = workload, .refreshed = Clock::now(), .refreshing = false};
+    });
+    return workload;
+}
+
+size_t Dispatcher::admit(const Client& client, uint64_t cost) {
+    const size_t workload = std::min(static_cast<size_t>(client.workload), kNumWorkloadClasses - 1);
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    // start-time fair queuing: a client starts no earlier than the class has
+    // progressed, nor before its previous execution has finished
+    std::unordered_map<pid_t, uint64_t>& finishTags = mFinishTags[workload];
+    if (finishTags.size() > kMaxTrackedClients) {
+        for (auto it = finishTags.begin(); it != finishTags.end();) {
+            it = it->second <= mVirtualTime[workload] ? finishTags.erase(it) : std::next(it);
+        }
+    }
+    uint64_t& finish = finishTags[client.pid];
+    const uint64_t start = std::max(mVirtualTime[workload], finish);
+    finish = start + std::max<uint64_t>(1, cost);
+
+    Waiter waiter{.admitted = false};
+    std::vector<QueueEntry>& queue = mQueues[workload];
+    queue.emplace_back(start, mArrivals++, &waiter);
+    std::push_heap(queue.begin(), queue.end(), std::greater<QueueEntry>());
+    admitLocked();
+    if (!waiter.admitted) {
+        mContended = true;
+        ++mWaits[workload];
+        mAdmitted.wait(lock, [&waiter]() { return waiter.admitted; });
+    }
+    return workload;
+}
+
+void Dispatcher::complete(size_t workload) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        --mInFlight;
+        ++mCompleted;
+        ++mExecutions[workload];
+        if (mAdaptive && !mPinned && mCompleted >= kWindowExecutions) {
+            adaptLocked(Clock::now());
+        }
+        admitLocked();
+    }
+    mAdmitted.notify_all();
+}
+
+void Dispatcher::admitLocked() {
+    for (size_t workload = 0; workload < kNumWorkloadClasses && mInFlight < mLimit;) {
+        std::vector<QueueEntry>& queue = mQueues[workload];
+        if (queue.empty()) {
+            ++workload;
+            continue;
+        }
+        std::pop_heap(queue.begin(), queue.end(), std::greater<QueueEntry>());
+        mVirtualTime[workload] = std::get<0>(queue.back());
+        std::get<2>(queue.back())->admitted = true;
+        queue.pop_back();
+        ++mInFlight;
+    }
+}
+
+void Dispatcher::adaptLocked(Clock::time_point now) {
+    const double seconds = std::chrono::duration<double>(now - mWindowStart).count();
+    const double throughput = seconds > 0 ? mCompleted / seconds : 0;
+
+    // Without callers waiting, the demand set the pace and the window says
+    // nothing about the limit. Otherwise more concurrency has to pay for
+    // itself, and less of it is kept as long as it costs nothing.
+    if (!mContended) {
+        mLastThroughput = 0;
+    } else {
+        if (mLastThroughput > 0) {
+            const bool keep = mStep > 0 ? throughput >= mLastThroughput * (1 + kTolerance)
+                                        : throughput >= mLastThroughput * (1 - kTolerance);
+            if (!keep) {
+                mStep = -mStep;
+            }
+        }
+        if ((mStep < 0 && mLimit == 1) || (mStep > 0 && mLimit == mMaxInFlight)) {
+            mStep = -mStep;
+        }
+        const uint32_t limit = std::min(mMaxInFlight, std::max<uint32_t>(1, mLimit + mStep));
+        if (limit != mLimit) {
+            LOG(VERBOSE) << "DSP concurrency " << mLimit << " -> " << limit << " at "
+                         << throughput << " executions/s";
+            mLimit = limit;
+        }
+        mLastThroughput = throughput;
+    }
+
+    mWindowStart = now;
+    mCompleted = 0;
+    mContended = false;
+}
+
+size_t Dispatcher::getQueued() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    size_t queued = 0;
+    for (const std::vector<QueueEntry>& queue : mQueues) {
+        queued += queue.size();
+    }
+    return queued;
+}
+
+void Dispatcher::setLimitForTesting(uint32_t limit) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mPinned = limit != 0;
+        mLimit = mPinned ? limit : mMaxInFlight;
+        admitLocked();
+    }
+    mAdmitted.notify_all();
+}
+
+std::string Dispatcher::dump() {
+    std::string os = "dispatcher:\n  prepare workers: " +
+                     std::to_string(mPreparePool.getMaxWorkers()) + ", " +
+                     std::to_string(mPreparePool.getQueued()) + " queued" +
+                     "\n  execute workers: " + std::to_string(mExecutePool.getMaxWorkers()) +
+                     ", " + std::to_string(mExecutePool.getQueued()) + " queued";
+    std::lock_guard<std::mutex> lock(mMutex);
+    os += "\n  concurrency: " + std::to_string(mLimit) + " of " + std::to_string(mMaxInFlight) +
+          (mAdaptive && !mPinned ? " (adaptive)" : " (fixed)") + "\n  in flight: " +
+          std::to_string(mInFlight) + "\n";
+    for (size_t i = 0; i < kNumWorkloadClasses; ++i) {
+        os += "  " + toString(static_cast<WorkloadClass>(i)) + ": " +
+              std::to_string(mExecutions[i]) + " executions, " + std::to_string(mWaits[i]) +
+              " waits, " + std::to_string(mQueues[i].size()) + " queued\n";
+    }
+    return os;
+}
+
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
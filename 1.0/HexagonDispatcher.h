@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef ANDROID_HARDWARE_V1_0_HEXAGON_DISPATCHER_H
+#define ANDROID_HARDWARE_V1_0_HEXAGON_DISPATCHER_H
+
+#include <sys/types.h>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "HexagonPowerManager.h"
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+
+// client an execution is run for
+struct Client {
+    WorkloadClass workload = WorkloadClass::NORMAL;
+    pid_t pid = 0;
+};
+
+// Classifies the caller of the current binder transaction. An explicit
+// persist.vendor.hvx.priority.<process name> wins, otherwise the class
+// follows the cpuset of the caller: top-app is interactive, background
+// groups are background, anything else is normal. The class is cached per
+// pid by the Dispatcher, so this does no I/O.
+Client getCallingClient();
+
+// Fixed number of threads running posted jobs, by strict priority of their
+// workload class and in order within a class. Threads are started on demand
+// and joined when the pool is destroyed; jobs still queued then are dropped.
+class WorkerPool {
+    // methods
+   public:
+    WorkerPool(const char* name, uint32_t maxWorkers);
+    ~WorkerPool();
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool(WorkerPool&&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+    WorkerPool& operator=(WorkerPool&&) = delete;
+
+    void post(WorkloadClass workload, std::function<void()> job);
+
+    uint32_t getMaxWorkers() const { return mMaxWorkers; }
+    size_t getQueued();
+
+   private:
+    void workerLoop();
+    size_t getQueuedLocked() const;
+
+    // members
+   private:
+    const char* const mName;
+    const uint32_t mMaxWorkers;
+
+    std::mutex mMutex;
+    std::condition_variable mQueued;
+    std::array<std::deque<std::function<void()>>, kNumWorkloadClasses> mJobs;
+    std::vector<std::thread> mWorkers;
+    uint32_t mIdleWorkers;
+    bool mStopping;
+};
+
+// Bounds the work handed to the DSP. Model preparations and executions run
+// on fixed pools of workers, and executions are admitted to the DSP up to a
+// concurrency limit. More executions in flight than the DSP can overlap only
+// add queueing, so the limit is adapted by hill climbing on the measured
+// execution throughput whenever callers are waiting for the DSP.
+//
+// Waiting executions are admitted by strict priority of their workload
+// class. Within a class, clients share the DSP by start-time fair queuing on
+// the estimated DSP time of their executions, so one client flooding a class
+// does not delay the others in it.
+class Dispatcher {
+    // methods
+   private:
+    Dispatcher();
+    ~Dispatcher() = default;
+    Dispatcher(const Dispatcher&) = delete;
+    Dispatcher(Dispatcher&&) = delete;
+    Dispatcher& operator=(const Dispatcher&) = delete;
+    Dispatcher& operator=(Dispatcher&&) = delete;
+
+    using Clock = std::chrono::steady_clock;
+
+    struct Waiter {
+        bool admitted;
+    };
+    // (start tag, arrival, waiter), kept as a min-heap
+    using QueueEntry = std::tuple<uint64_t, uint64_t, Waiter*>;
+
+    // Waits until an execution for client is admitted to the DSP, and
+    // returns the queue index of its class.
+    size_t admit(const Client& client, uint64_t cost);
+    void complete(size_t workload);
+    void adaptLocked(Clock::time_point now);
+    void admitLocked();
+
+   public:
+    static Dispatcher& getInstance();
+
+    // Queues a preparation for the next free prepare worker.
+    void post(std::function<void()> preparation);
+    // Queues a job on the prepare workers, behind the preparations of more
+    // urgent classes, e.g. background work of the driver itself.
+    void post(WorkloadClass workload, std::function<void()> job);
+
+    // Queues an asynchronous execution for client on the next free execute
+    // worker (vendor.hvx.threads.execute). It is still admitted to the DSP by
+    // dispatch.
+    void post(const Client& client, std::function<void()> execution);
+
+    // Runs an execution for client on the DSP once it is admitted, and
+    // returns its result. cost is the estimated DSP time in microseconds.
+    // Takes the execution as is, so that executions are dispatched without
+    // allocating.
+    template <typename Execution>
+    int dispatch(const Client& client, uint64_t cost, Execution&& execution) {
+        const size_t workload = admit(client, cost);
+        const int result = execution();
+        complete(workload);
+        return result;
+    }
+
+    // Cached workload class of pid. Unknown and stale entries are refreshed
+    // in the background (vendor.hvx.priority.refresh_ms); a pid seen for the
+    // first time is normal until then.
+    WorkloadClass getWorkloadClass(pid_t pid);
+
+    // waiting executions, of every class
+    size_t getQueued();
+
+    // Pins the DSP concurrency at limit, or goes back to the adaptive limit
+    // if 0, for the tests.
+    void setLimitForTesting(uint32_t limit);
+
+    std::string dump();
+
+    // members
+   private:
+    const uint32_t mMaxInFlight;
+    const bool mAdaptive;
+    const std::chrono::milliseconds mClassRefresh;
+
+    struct ClientClass {
+        WorkloadClass workload;
+        Clock::time_point refreshed;
+        bool refreshing;
+    };
+    std::mutex mClientMutex;
+    std::unordered_map<pid_t, ClientClass> mClients;
+
+    std::mutex mMutex;
+    std::condition_variable mAdmitted;
+    uint32_t mLimit;
+    bool mPinned;
+    uint32_t mInFlight;
+
+    // per workload class: waiting executions, virtual time, and the finish
+    // tag of the last execution of each client
+    std::array<std::vector<QueueEntry>, kNumWorkloadClasses> mQueues;
+    std::array<uint64_t, kNumWorkloadClasses> mVirtualTime;
+    std::array<std::unordered_map<pid_t, uint64_t>, kNumWorkloadClasses> mFinishTags;
+    uint64_t mArrivals;
+
+    // current adaptation window
+    Clock::time_point mWindowStart;
+    uint32_t mCompleted;
+    bool mContended;
+    double mLastThroughput;
+    int32_t mStep;
+
+    std::array<uint64_t, kNumWorkloadClasses> mExecutions;
+    std::array<uint64_t, kNumWorkloadClasses> mWaits;
+
+    // last, so that they are joined before the admission state goes away
+    WorkerPool mPreparePool;
+    WorkerPool mExecutePool;
+};
+
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_V1_0_HEXAGON_DISPATCHER_H
@@ -0,0 +1,668 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "android.hardware.neuralnetworks@1.0-impl-hvx"
+
+#include "HexagonGraph.h"
+#include <android-base/file.h>
+#include <android-base/unique_fd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <iterator>
+#include <numeric>
+#include <unordered_map>
+#include <unordered_set>
+#include "HexagonController.h"
+#include "HexagonGraphEvictor.h"
+#include "HexagonMemoryBudget.h"
+#include "HexagonUtils.h"
+#include "HexagonWatchdog.h"
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+
+ConstantBuffer::ConstantBuffer(std::vector<uint8_t> bytes)
+    : mBytes(std::move(bytes)), mMapping(nullptr), mData(mBytes.data()), mSize(mBytes.size()) {}
+
+ConstantBuffer::ConstantBuffer(void* mapping, size_t size)
+    : mMapping(mapping), mData(static_cast<const uint8_t*>(mapping)), mSize(size) {}
+
+ConstantBuffer::~ConstantBuffer() {
+    if (mMapping != nullptr) {
+        munmap(mMapping, mSize);
+    }
+}
+
+Graph::Graph() : mNextId(0) {}
+
+Graph::Graph(std::vector<GraphNode> nodes) : mNodes(std::move(nodes)), mNextId(0) {
+    for (const GraphNode& node : mNodes) {
+        mNextId = std::max(mNextId, node.id);
+    }
+}
+
+uint32_t Graph::addConstNode(uint32_t batches, uint32_t height, uint32_t width, uint32_t depth,
+                             const uint8_t* data, size_t size) {
+    mNodes.push_back({
+        .id = ++mNextId,
+        .op = OP_Const,
+        .padding = NN_PAD_NA,
+        .inputs = {},
+        .outputs = {},
+        .batches = batches,
+        .height = height,
+        .width = width,
+        .depth = depth,
+        .buffer = std::make_shared<ConstantBuffer>(std::vector<uint8_t>(data, data + size)),
+        .offset = 0,
+        .size = size,
+    });
+    return mNextId;
+}
+
+uint32_t Graph::addNode(op_type op, hexagon_nn_padding_type padding,
+                        const std::vector<hexagon_nn_input>& inputs,
+                        const std::vector<hexagon_nn_output>& outputs) {
+    mNodes.push_back({
+        .id = ++mNextId,
+        .op = op,
+        .padding = padding,
+        .inputs = inputs,
+        .outputs = outputs,
+        .batches = 0,
+        .height = 0,
+        .width = 0,
+        .depth = 0,
+        .buffer = nullptr,
+        .offset = 0,
+        .size = 0,
+    });
+    return mNextId;
+}
+
+void Graph::clear() {
+    mNodes.clear();
+    mNextId = 0;
+}
+
+static uint64_t getBytes(const hexagon_nn_output& output) {
+    uint64_t size = output.elementsize;
+    for (uint32_t i = 0; i < output.rank; ++i) {
+        size *= output.max_sizes[i];
+    }
+    return size;
+}
+
+uint64_t Graph::getDspBytes() const {
+    uint64_t bytes = 0;
+    for (const GraphNode& node : mNodes) {
+        bytes += node.size;
+        for (const hexagon_nn_output& output : node.outputs) {
+            bytes += getBytes(output);
+        }
+    }
+    return bytes;
+}
+
+namespace {
+
+// Dependencies between the nodes of a graph, by node index.
+class Dependencies {
+   public:
+    explicit Dependencies(const std::vector<GraphNode>& nodes) : mNodes(nodes) {
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            mIndices[nodes[i].id] = i;
+        }
+        mReaders.resize(nodes.size());
+        mConsumers.resize(nodes.size());
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            mReaders[i].assign(nodes[i].outputs.size(), 0);
+        }
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            for (const hexagon_nn_input& input : nodes[i].inputs) {
+                size_t source;
+                if (resolve(input, &source)) {
+                    ++mReaders[source][input.output_idx];
+                }
+                if (find(input.src_id, &source)) {
+                    mConsumers[source].push_back(i);
+                }
+            }
+        }
+    }
+
+    bool find(uint32_t id, size_t* index) const {
+        const auto entry = mIndices.find(id);
+        if (entry == mIndices.end()) {
+            return false;
+        }
+        *index = entry->second;
+        return true;
+    }
+
+    // Finds the node of an activation input. Constants and unknown nodes have
+    // no activation.
+    bool resolve(const hexagon_nn_input& input, size_t* source) const {
+        return find(input.src_id, source) && input.output_idx < mReaders[*source].size();
+    }
+
+    // Change in live bytes once the node has run: its outputs are allocated,
+    // and the inputs it is the last reader of are freed. Outputs that are never
+    // read are freed right away.
+    int64_t getDelta(size_t index, const std::vector<std::vector<uint32_t>>& readers) const {
+        const GraphNode& node = mNodes[index];
+        int64_t delta = 0;
+        for (size_t i = 0; i < node.outputs.size(); ++i) {
+            if (readers[index][i] > 0) {
+                delta += getBytes(node.outputs[i]);
+            }
+        }
+        for (size_t i = 0; i < node.inputs.size(); ++i) {
+            const hexagon_nn_input& input = node.inputs[i];
+            const auto same = [&input](const hexagon_nn_input& other) {
+                return other.src_id == input.src_id && other.output_idx == input.output_idx;
+            };
+            size_t source;
+            // an input read several times is counted once, on its first read
+            if (!resolve(input, &source) ||
+                std::any_of(node.inputs.begin(), node.inputs.begin() + i, same)) {
+                continue;
+            }
+            const uint32_t uses = std::count_if(node.inputs.begin(), node.inputs.end(), same);
+            if (uses == readers[source][input.output_idx]) {
+                delta -= getBytes(mNodes[source].outputs[input.output_idx]);
+            }
+        }
+        return delta;
+    }
+
+    // Estimated peak of activation bytes live at once when the nodes run in
+    // order.
+    uint64_t getPeakBytes(const std::vector<size_t>& order) const {
+        std::vector<std::vector<uint32_t>> readers = mReaders;
+        uint64_t live = 0;
+        uint64_t peak = 0;
+        for (size_t index : order) {
+            const GraphNode& node = mNodes[index];
+            for (const hexagon_nn_output& output : node.outputs) {
+                live += getBytes(output);
+            }
+            peak = std::max(peak, live);
+            for (const hexagon_nn_input& input : node.inputs) {
+                size_t source;
+                if (resolve(input, &source) && --readers[source][input.output_idx] == 0) {
+                    live -= getBytes(mNodes[source].outputs[input.output_idx]);
+                }
+            }
+            for (size_t i = 0; i < node.outputs.size(); ++i) {
+                if (mReaders[index][i] == 0) {
+                    live -= getBytes(node.outputs[i]);
+                }
+            }
+        }
+        return peak;
+    }
+
+    const std::vector<std::vector<uint32_t>>& getReaders() const { return mReaders; }
+    const std::vector<size_t>& getConsumers(size_t index) const { return mConsumers[index]; }
+
+   private:
+    const std::vector<GraphNode>& mNodes;
+    std::unordered_map<uint32_t, size_t> mIndices;
+    // readers left of each output of each node
+    std::vector<std::vector<uint32_t>> mReaders;
+    // nodes reading any output of each node, once per input
+    std::vector<std::vector<size_t>> mConsumers;
+};
+
+}  // anonymous namespace
+
+void Graph::schedule() {
+    const Dependencies dependencies(mNodes);
+    const size_t count = mNodes.size();
+
+    // constants and the input node come first, the output node last
+    std::vector<size_t> order;
+    std::vector<bool> scheduled(count, false);
+    for (size_t i = 0; i < count; ++i) {
+        if (mNodes[i].op == OP_Const || mNodes[i].op == OP_INPUT) {
+            order.push_back(i);
+            scheduled[i] = true;
+        }
+    }
+
+    std::vector<uint32_t> pending(count, 0);
+    std::vector<size_t> ready;
+    for (size_t i = 0; i < count; ++i) {
+        if (scheduled[i] || mNodes[i].op == OP_OUTPUT) {
+            continue;
+        }
+        for (const hexagon_nn_input& input : mNodes[i].inputs) {
+            size_t source;
+            if (dependencies.find(input.src_id, &source) && !scheduled[source]) {
+                ++pending[i];
+            }
+        }
+        if (pending[i] == 0) {
+            ready.push_back(i);
+        }
+    }
+
+    // Greedily runs the ready node that grows the live bytes the least, the
+    // earliest one in the original order on ties.
+    std::vector<std::vector<uint32_t>> readers = dependencies.getReaders();
+    while (!ready.empty()) {
+        auto best = ready.begin();
+        int64_t bestDelta = dependencies.getDelta(*best, readers);
+        for (auto it = std::next(ready.begin()); it != ready.end(); ++it) {
+            const int64_t delta = dependencies.getDelta(*it, readers);
+            if (delta < bestDelta || (delta == bestDelta && *it < *best)) {
+                best = it;
+                bestDelta = delta;
+            }
+        }
+        const size_t index = *best;
+        ready.erase(best);
+        order.push_back(index);
+        scheduled[index] = true;
+
+        for (const hexagon_nn_input& input : mNodes[index].inputs) {
+            size_t source;
+            if (dependencies.resolve(input, &source)) {
+                --readers[source][input.output_idx];
+            }
+        }
+        for (size_t consumer : dependencies.getConsumers(index)) {
+            if (mNodes[consumer].op != OP_OUTPUT && --pending[consumer] == 0) {
+                ready.push_back(consumer);
+            }
+        }
+    }
+    for (size_t i = 0; i < count; ++i) {
+        if (mNodes[i].op == OP_OUTPUT) {
+            order.push_back(i);
+        }
+    }
+    if (order.size() != count) {
+        LOG(ERROR) << "Graph nodes could not be scheduled, keeping them in model order";
+        return;
+    }
+
+    std::vector<size_t> original(count);
+    std::iota(original.begin(), original.end(), 0);
+    const uint64_t before = dependencies.getPeakBytes(original);
+    const uint64_t after = dependencies.getPeakBytes(order);
+    LOG(INFO) << "Estimated peak of live activations: " << before << " bytes in model order, "
+              << after << " bytes scheduled";
+    if (after >= before) {
+        return;
+    }
+
+    std::vector<GraphNode> nodes;
+    nodes.reserve(count);
+    for (size_t index : order) {
+        nodes.push_back(std::move(mNodes[index]));
+    }
+    mNodes.swap(nodes);
+}
+
+uint64_t Graph::getHostBytes() const {
+    uint64_t bytes = mNodes.capacity() * sizeof(GraphNode);
+    std::unordered_set<const ConstantBuffer*> buffers;
+    for (const GraphNode& node : mNodes) {
+        bytes += node.inputs.capacity() * sizeof(hexagon_nn_input) +
+                 node.outputs.capacity() * sizeof(hexagon_nn_output);
+        if (node.buffer != nullptr && !node.buffer->isMapped() &&
+            buffers.insert(node.buffer.get()).second) {
+            bytes += sizeof(ConstantBuffer) + node.buffer->size();
+        }
+    }
+    return bytes;
+}
+
+static uint64_t getHash(const uint8_t* data, size_t size) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ data[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+void Graph::shareConstants(const Graph& other) {
+    std::unordered_multimap<uint64_t, const GraphNode*> constants;
+    for (const GraphNode& node : other.mNodes) {
+        if (node.buffer != nullptr) {
+            constants.emplace(getHash(node.getData(), node.size), &node);
+        }
+    }
+    uint64_t shared = 0;
+    for (GraphNode& node : mNodes) {
+        if (node.buffer == nullptr) {
+            continue;
+        }
+        auto range = constants.equal_range(getHash(node.getData(), node.size));
+        for (auto it = range.first; it != range.second; ++it) {
+            const GraphNode& candidate = *it->second;
+            if (candidate.size == node.size &&
+                std::equal(node.getData(), node.getData() + node.size, candidate.getData())) {
+                node.buffer = candidate.buffer;
+                node.offset = candidate.offset;
+                shared += node.size;
+                break;
+            }
+        }
+    }
+    LOG(VERBOSE) << "Sharing " << shared << " bytes of constants";
+}
+
+bool Graph::seal() {
+    // every heap constant, 8-byte aligned
+    std::vector<size_t> offsets(mNodes.size());
+    size_t size = 0;
+    for (size_t i = 0; i < mNodes.size(); ++i) {
+        if (mNodes[i].buffer != nullptr && !mNodes[i].buffer->isMapped()) {
+            offsets[i] = size;
+            size += (mNodes[i].size + 7) & ~size_t{7};
+        }
+    }
+    if (size == 0) {
+        return true;
+    }
+
+    // shared memory rather than a file on /data, so that constants paged
+    // out go to swap instead of being written to flash by every prepare
+    ::android::base::unique_fd fd(memfd_create("hvx-constants", MFD_CLOEXEC));
+    if (!fd.ok()) {
+        PLOG(WARNING) << "Failed to create a constants file, keeping the constants on the heap";
+        return false;
+    }
+    HEXAGON_SOFT_ASSERT_EQ(0, ftruncate(fd.get(), size), "Failed to size the constants file");
+    for (size_t i = 0; i < mNodes.size(); ++i) {
+        const GraphNode& node = mNodes[i];
+        if (node.buffer == nullptr || node.buffer->isMapped()) {
+            continue;
+        }
+        HEXAGON_SOFT_ASSERT(lseek(fd.get(), offsets[i], SEEK_SET) >= 0 &&
+                                ::android::base::WriteFully(fd.get(), node.getData(), node.size),
+                            "Failed to write the constants file");
+    }
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd.get(), 0);
+    HEXAGON_SOFT_ASSERT_NE(MAP_FAILED, mapping, "Failed to map the constants file");
+
+    const std::shared_ptr<const ConstantBuffer> buffer =
+        std::make_shared<ConstantBuffer>(mapping, size);
+    for (size_t i = 0; i < mNodes.size(); ++i) {
+        if (mNodes[i].buffer != nullptr && !mNodes[i].buffer->isMapped()) {
+            mNodes[i].buffer = buffer;
+            mNodes[i].offset = offsets[i];
+        }
+    }
+    return true;
+}
+
+static bool appendNode(hexagon_nn_nn_id id, const GraphNode& node) {
+    Controller& controller = Controller::getInstance();
+    if (node.op == OP_Const) {
+        return controller.append_const_node(id, node.id, node.batches, node.height, node.width,
+                                            node.depth, node.getData(), node.size) == 0;
+    }
+    return controller.append_node(id, node.id, node.op, node.padding, node.inputs.data(),
+                                  node.inputs.size(), node.outputs.data(),
+                                  node.outputs.size()) == 0;
+}
+
+hexagon_nn_nn_id Graph::materialize(uint64_t* generation) const {
+    // The whole build is supervised, as any of its calls can hang. An
+    // abandoned build outlives this call, so it owns the nodes it appends
+    // (their constants are shared, not copied) and the graph it reports.
+    struct Built {
+        hexagon_nn_nn_id id;
+        uint64_t generation;
+    };
+    auto built = std::make_shared<Built>(Built{.id = 0, .generation = 0});
+    auto build = [built, nodes = mNodes]() {
+        Controller& controller = Controller::getInstance();
+        hexagon_nn_nn_id graph = 0;
+        uint64_t generation = 0;
+        int err = controller.init(&graph, &generation);
+        if (err != 0 || graph == 0) {
+            LOG(ERROR) << "Hexagon could not allocate new graph";
+            return -1;
+        }
+        controller.set_debug_level(graph, 0);
+
+        for (const GraphNode& node : nodes) {
+            // once nnlib is reset, the id may belong to another graph
+            if (controller.getGeneration() != generation) {
+                LOG(ERROR) << "nnlib was reset while the graph was built";
+                return -1;
+            }
+            if (!appendNode(graph, node)) {
+                LOG(ERROR) << "Failed to append node " << node.id << " (" << toString(node.op)
+                           << "). Tearing down the graph.";
+                controller.teardown(graph, generation);
+                return -1;
+            }
+        }
+
+        err = controller.prepare(graph);
+        if (err != 0) {
+            controller.teardown(graph, generation);
+            return err;
+        }
+        *built = {.id = graph, .generation = generation};
+        return 0;
+    };
+
+    // a graph lost to a watchdog reset is gone already
+    const int err = Watchdog::getInstance().supervise(
+        "prepare", Watchdog::getInstance().getPrepareDeadline(), std::move(build));
+    if (err != 0) {
+        return 0;
+    }
+    *generation = built->generation;
+    return built->id;
+}
+
+GraphPool::GraphPool(const void* owner, size_t maxReplicas)
+    : mOwner(owner),
+      mMaxReplicas(std::max<size_t>(1, maxReplicas)),
+      mLimit(mMaxReplicas),
+      mEvicted(false),
+      mLastUsed(GraphEvictor::Clock::now().time_since_epoch().count()) {
+    GraphEvictor::getInstance().add(this);
+}
+
+GraphPool::~GraphPool() {
+    GraphEvictor::getInstance().remove(this);
+    clear();
+}
+
+void GraphPool::teardown(const Replica& replica) {
+    // a replica from an older generation went away with the nnlib instance
+    // that owned it, and its id may have been reused since
+    if (replica.id != hexagon_nn_nn_id{}) {
+        Controller::getInstance().teardown(replica.id, replica.generation);
+    }
+}
+
+bool GraphPool::initialize(const Graph& graph) {
+    hexagon_nn_nn_id id = acquire(graph);
+    if (id == hexagon_nn_nn_id{}) {
+        return false;
+    }
+    release(id);
+    return true;
+}
+
+hexagon_nn_nn_id GraphPool::acquire(const Graph& graph) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    Replica* replica = nullptr;
+    while (replica == nullptr) {
+        for (Replica& candidate : mReplicas) {
+            if (!candidate.busy) {
+                replica = &candidate;
+                break;
+            }
+        }
+        if (replica == nullptr && mReplicas.size() < mLimit) {
+            replica = addReplicaLocked(graph, &lock);
+        }
+        if (replica == nullptr) {
+            if (mReplicas.empty()) {
+                return hexagon_nn_nn_id{};
+            }
+            mReleased.wait(lock);
+        }
+    }
+    replica->busy = true;
+    touch();
+
+    const uint64_t generation = Controller::getInstance().getGeneration();
+    if (replica->id != hexagon_nn_nn_id{} && replica->generation == generation) {
+        return replica->id;
+    }
+
+    // (re)build outside of the lock; the replica is reserved
+    const bool rebuild = replica->id != hexagon_nn_nn_id{};
+    const bool evicted = mEvicted;
+    mEvicted = false;
+    lock.unlock();
+    if (rebuild) {
+        LOG(INFO) << "Rebuilding graph lost to an nnlib reset";
+        Watchdog::getInstance().onRebuild();
+    }
+    const GraphEvictor::Clock::time_point start = GraphEvictor::Clock::now();
+    uint64_t built = 0;
+    const hexagon_nn_nn_id id = graph.materialize(&built);
+    if (evicted && id != hexagon_nn_nn_id{}) {
+        GraphEvictor::getInstance().onRebuild(GraphEvictor::Clock::now() - start);
+    }
+    lock.lock();
+
+    if (id == hexagon_nn_nn_id{}) {
+        // a replica that cannot be built must not hold on to its share of
+        // the budget, nor be handed out again
+        MemoryBudget::getInstance().release(mOwner, replica->dspBytes);
+        mReplicas.remove_if([replica](const Replica& other) { return &other == replica; });
+        mReleased.notify_one();
+        return id;
+    }
+    replica->id = id;
+    replica->generation = built;
+    return id;
+}
+
+GraphPool::Replica* GraphPool::addReplicaLocked(const Graph& graph,
+                                                std::unique_lock<std::mutex>* lock) {
+    MemoryBudget& budget = MemoryBudget::getInstance();
+    const uint64_t dspBytes = graph.getDspBytes();
+
+    // make room for the first replica by evicting idle graphs of other
+    // models; additional replicas only use what is free
+    if (mReplicas.empty() && !budget.fits(dspBytes)) {
+        lock->unlock();
+        GraphEvictor::getInstance().reclaim(dspBytes, this);
+        lock->lock();
+    }
+    if (mReplicas.size() >= mLimit) {
+        return nullptr;
+    }
+    if (!budget.reserve(mOwner, dspBytes)) {
+        // make do with the replicas there are
+        if (!mReplicas.empty()) {
+            mLimit = mReplicas.size();
+        }
+        return nullptr;
+    }
+    mReplicas.push_back({.id = 0, .generation = 0, .busy = false, .dspBytes = dspBytes});
+    return &mReplicas.back();
+}
+
+void GraphPool::release(hexagon_nn_nn_id id) {
+    touch();
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (Replica& replica : mReplicas) {
+            if (replica.id == id && replica.busy) {
+                replica.busy = false;
+                break;
+            }
+        }
+    }
+    mReleased.notify_one();
+}
+
+void GraphPool::clear() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (const Replica& replica : mReplicas) {
+        teardown(replica);
+        MemoryBudget::getInstance().release(mOwner, replica.dspBytes);
+    }
+    mReplicas.clear();
+    mLimit = mMaxReplicas;
+}
+
+uint64_t GraphPool::evict() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mReplicas.empty() || std::any_of(mReplicas.begin(), mReplicas.end(),
+                                         [](const Replica& replica) { return replica.busy; })) {
+        return 0;
+    }
+
+    uint64_t bytes = 0;
+    for (const Replica& replica : mReplicas) {
+        teardown(replica);
+        MemoryBudget::getInstance().release(mOwner, replica.dspBytes);
+        bytes += replica.dspBytes;
+    }
+    mReplicas.clear();
+    mLimit = mMaxReplicas;
+    mEvicted = true;
+    return bytes;
+}
+
+void GraphPool::touch() {
+    mLastUsed = GraphEvictor::Clock::now().time_since_epoch().count();
+}
+
+GraphEvictor::Clock::time_point GraphPool::getLastUsed() const {
+    return GraphEvictor::Clock::time_point(GraphEvictor::Clock::duration(mLastUsed.load()));
+}
+
+hexagon_nn_nn_id GraphPool::peek() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mReplicas.empty() ? hexagon_nn_nn_id{} : mReplicas.front().id;
+}
+
+size_t GraphPool::size() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mReplicas.size();
+}
+
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_V1_0_HEXAGON_GRAPH_H
+#define ANDROID_HARDWARE_V1_0_HEXAGON_GRAPH_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "HexagonGraphEvictor.h"
+#include "hexagon_nn_controller/hexagon_nn_controller.h"
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+
+// Memory holding the values of constant nodes: a heap buffer while a graph
+// is lowered, or a read-only file mapping, whose pages the kernel can swap
+// out, or drop and read back from the compilation cache, between rebuilds.
+class ConstantBuffer {
+   public:
+    explicit ConstantBuffer(std::vector<uint8_t> bytes);
+    // takes over a read-only mapping of size bytes
+    ConstantBuffer(void* mapping, size_t size);
+    ~ConstantBuffer();
+    ConstantBuffer(const ConstantBuffer&) = delete;
+    ConstantBuffer& operator=(const ConstantBuffer&) = delete;
+
+    const uint8_t* data() const { return mData; }
+    size_t size() const { return mSize; }
+    bool isMapped() const { return mMapping != nullptr; }
+
+   private:
+    const std::vector<uint8_t> mBytes;
+    void* const mMapping;
+    const uint8_t* const mData;
+    const size_t mSize;
+};
+
+// node of a lowered graph, as it is appended to nnlib
+struct GraphNode {
+    uint32_t id;
+    op_type op;
+    hexagon_nn_padding_type padding;
+    std::vector<hexagon_nn_input> inputs;
+    std::vector<hexagon_nn_output> outputs;
+
+    // constant nodes (OP_Const) only: shape, and the values at offset in
+    // buffer
+    uint32_t batches;
+    uint32_t height;
+    uint32_t width;
+    uint32_t depth;
+    std::shared_ptr<const ConstantBuffer> buffer;
+    size_t offset;
+    size_t size;
+
+    const uint8_t* getData() const { return buffer != nullptr ? buffer->data() + offset : nullptr; }
+};
+
+// Host-side recipe of a lowered nnlib graph. Lowering records nodes here, and
+// the recipe is then materialized into nnlib, as many times as needed (e.g.
+// after nnlib has been reset) without going back to the NNAPI model.
+class Graph {
+   public:
+    Graph();
+    // a recipe recorded earlier, e.g. read back from the compilation cache
+    explicit Graph(std::vector<GraphNode> nodes);
+
+    uint32_t addConstNode(uint32_t batches, uint32_t height, uint32_t width, uint32_t depth,
+                          const uint8_t* data, size_t size);
+    uint32_t addNode(op_type op, hexagon_nn_padding_type padding,
+                     const std::vector<hexagon_nn_input>& inputs,
+                     const std::vector<hexagon_nn_output>& outputs);
+
+    const std::vector<GraphNode>& getNodes() const { return mNodes; }
+    bool empty() const { return mNodes.empty(); }
+    void clear();
+
+    // Estimated DSP memory of one materialized graph: its constants, and
+    // activation buffers of the max size of every output.
+    uint64_t getDspBytes() const;
+    // host heap memory held by the recipe; mapped constants are not counted
+    uint64_t getHostBytes() const;
+
+    // Moves the constants off the heap, into one anonymous shared memory file
+    // that is mapped read-only. Returns false, keeping the constants on the
+    // heap, if the file cannot be created.
+    bool seal();
+
+    // Makes the constant nodes with the same values as one of other refer to
+    // the buffer of other.
+    void shareConstants(const Graph& other);
+
+    // Reorders the nodes, each still after its inputs, to lower the estimated
+    // peak of activation bytes live at once, as nnlib runs them in order.
+    void schedule();
+
+    // Creates and prepares the graph in nnlib. Returns its id, or 0 on error,
+    // and the nnlib generation it belongs to in generation.
+    hexagon_nn_nn_id materialize(uint64_t* generation) const;
+
+   private:
+    std::vector<GraphNode> mNodes;
+    uint32_t mNextId;
+};
+
+// Replicas of a materialized graph. Executions each take a free replica, so
+// concurrent executions of one model never share an nnlib graph. Replicas are
+// created on demand, up to a maximum, and rebuilt from the recipe when nnlib
+// has been reset since they were made, or after they were evicted.
+class GraphPool {
+   public:
+    // DSP memory of the replicas is accounted to owner
+    GraphPool(const void* owner, size_t maxReplicas);
+    ~GraphPool();
+    GraphPool(const GraphPool&) = delete;
+    GraphPool& operator=(const GraphPool&) = delete;
+
+    // Materializes the first replica.
+    bool initialize(const Graph& graph);
+
+    // Returns a free replica, waiting while all of them are busy. Returns 0
+    // if no replica could be materialized, or if the DSP memory budget does
+    // not allow for any.
+    hexagon_nn_nn_id acquire(const Graph& graph);
+    void release(hexagon_nn_nn_id id);
+
+    // Tears down every replica. Must not race with acquire.
+    void clear();
+
+    // Tears down every replica if none is in use, keeping the recipe to
+    // materialize them again. Returns the DSP bytes freed.
+    uint64_t evict();
+    GraphEvictor::Clock::time_point getLastUsed() const;
+
+    // any replica, for debugging
+    hexagon_nn_nn_id peek();
+    size_t size();
+
+   private:
+    struct Replica {
+        hexagon_nn_nn_id id;
+        uint64_t generation;
+        bool busy;
+        uint64_t dspBytes;
+    };
+
+    static void teardown(const Replica& replica);
+    Replica* addReplicaLocked(const Graph& graph, std::unique_lock<std::mutex>* lock);
+    void touch();
+
+    const void* const mOwner;
+    const size_t mMaxReplicas;
+    std::mutex mMutex;
+    size_t mLimit;  // lowered when the memory budget is exhausted
+    bool mEvicted;
+    std::atomic<GraphEvictor::Clock::rep> mLastUsed;
+    std::condition_variable mReleased;
+    // a list, as replicas are built outside of the lock and may fail
+    std::list<Replica> mReplicas;
+};
+
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_V1_0_HEXAGON_GRAPH_H
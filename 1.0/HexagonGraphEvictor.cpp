@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "android.hardware.neuralnetworks@1.0-impl-hvx"
+
+#include "HexagonGraphEvictor.h"
+#include <android-base/logging.h>
+#include <android-base/properties.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include "HexagonGraph.h"
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+
+namespace {
+
+int64_t toMillis(GraphEvictor::Clock::duration duration) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+}
+
+}  // anonymous namespace
+
+GraphEvictor::GraphEvictor()
+    : mIdleTimeout(
+          ::android::base::GetUintProperty<uint32_t>("vendor.hvx.evict.idle_timeout_ms", 60000)),
+      mStopping(false),
+      mIdleEvictions(0),
+      mPressureEvictions(0),
+      mEvictedBytes(0),
+      mRebuilds(0),
+      mRebuildTime(0),
+      mMaxRebuildTime(0) {
+    if (mIdleTimeout.count() > 0) {
+        mIdleThread = std::thread([this]() { idleLoop(); });
+    }
+}
+
+GraphEvictor::~GraphEvictor() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mStop.notify_all();
+    if (mIdleThread.joinable()) {
+        mIdleThread.join();
+    }
+}
+
+GraphEvictor& GraphEvictor::getInstance() {
+    static GraphEvictor instance{};
+    return instance;
+}
+
+void GraphEvictor::add(GraphPool* pool) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mPools.insert(pool);
+}
+
+void GraphEvictor::remove(GraphPool* pool) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mPools.erase(pool);
+    mEvicted.wait(lock, [this, pool]() { return mEvicting.count(pool) == 0; });
+}
+
+uint64_t GraphEvictor::evict(GraphPool* pool, std::unique_lock<std::mutex>* lock) {
+    // the pool may have gone away while the lock was released
+    if (mPools.count(pool) == 0) {
+        return 0;
+    }
+    mEvicting.insert(pool);
+    lock->unlock();
+    const uint64_t bytes = pool->evict();
+    lock->lock();
+    mEvicting.erase(mEvicting.find(pool));
+    mEvicted.notify_all();
+    mEvictedBytes += bytes;
+    return bytes;
+}
+
+void GraphEvictor::idleLoop() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    std::vector<GraphPool*> candidates;
+    while (!mStopping) {
+        const Clock::time_point now = Clock::now();
+        Clock::time_point next = now + mIdleTimeout;
+        candidates.clear();
+        for (GraphPool* pool : mPools) {
+            const Clock::time_point deadline = pool->getLastUsed() + mIdleTimeout;
+            if (deadline > now) {
+                next = std::min(next, deadline);
+            } else {
+                candidates.push_back(pool);
+            }
+        }
+        // the teardowns are DSP calls, made without holding up add and
+        // remove of every other pool
+        for (GraphPool* pool : candidates) {
+            if (evict(pool, &lock) > 0) {
+                ++mIdleEvictions;
+            }
+        }
+        mStop.wait_until(lock, next);
+    }
+}
+
+bool GraphEvictor::reclaim(uint64_t bytes, const GraphPool* requester) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    std::vector<std::pair<Clock::time_point, GraphPool*>> candidates;
+    for (GraphPool* pool : mPools) {
+        if (pool != requester) {
+            candidates.emplace_back(pool->getLastUsed(), pool);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    uint64_t freed = 0;
+    for (const auto& candidate : candidates) {
+        if (freed >= bytes) {
+            break;
+        }
+        const uint64_t evicted = evict(candidate.second, &lock);
+        if (evicted > 0) {
+            ++mPressureEvictions;
+            freed += evicted;
+        }
+    }
+    lock.unlock();
+    if (freed > 0) {
+        LOG(INFO) << "Evicted " << freed << " bytes of graphs to make room for " << bytes;
+    }
+    return freed >= bytes;
+}
+
+void GraphEvictor::onRebuild(Clock::duration latency) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    ++mRebuilds;
+    mRebuildTime += latency;
+    mMaxRebuildTime = std::max(mMaxRebuildTime, latency);
+}
+
+std::string GraphEvictor::dump() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    const int64_t average = mRebuilds > 0 ? toMillis(mRebuildTime) / mRebuilds : 0;
+    return "graph eviction:\n  idle timeout: " + std::to_string(mIdleTimeout.count()) +
+           " ms\n  idle evictions: " + std::to_string(mIdleEvictions) +
+           "\n  pressure evictions: " + std::to_string(mPressureEvictions) +
+           "\n  evicted bytes: " + std::to_string(mEvictedBytes) +
+           "\n  rebuilds: " + std::to_string(mRebuilds) +
+           "\n  rebuild latency: " + std::to_string(average) + " ms average, " +
+           std::to_string(toMillis(mMaxRebuildTime)) + " ms max\n";
+}
+
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_V1_0_HEXAGON_GRAPH_EVICTOR_H
+#define ANDROID_HARDWARE_V1_0_HEXAGON_GRAPH_EVICTOR_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+
+class GraphPool;
+
+// Tears down the nnlib graphs of models that have not been executed for a
+// while (vendor.hvx.evict.idle_timeout_ms, never if 0), and of the least
+// recently used models when the DSP memory budget runs out. Only the host
+// recipe of an evicted graph is kept; the graph is materialized again by its
+// next execution.
+class GraphEvictor {
+    // methods
+   private:
+    GraphEvictor();
+    ~GraphEvictor();
+    GraphEvictor(const GraphEvictor&) = delete;
+    GraphEvictor(GraphEvictor&&) = delete;
+    GraphEvictor& operator=(const GraphEvictor&) = delete;
+    GraphEvictor& operator=(GraphEvictor&&) = delete;
+
+    void idleLoop();
+    // Evicts pool, unless it was removed, with the lock released for the
+    // teardown.
+    uint64_t evict(GraphPool* pool, std::unique_lock<std::mutex>* lock);
+
+   public:
+    using Clock = std::chrono::steady_clock;
+
+    static GraphEvictor& getInstance();
+
+    void add(GraphPool* pool);
+    // Waits for an eviction of pool in progress.
+    void remove(GraphPool* pool);
+
+    // Evicts idle graphs, least recently used first, until at least bytes
+    // of DSP memory have been freed. Must not be called with the lock of a
+    // pool held.
+    bool reclaim(uint64_t bytes, const GraphPool* requester);
+
+    void onRebuild(Clock::duration latency);
+
+    std::string dump();
+
+    // members
+   private:
+    const std::chrono::milliseconds mIdleTimeout;
+
+    std::mutex mMutex;
+    std::condition_variable mStop;
+    bool mStopping;
+    std::set<GraphPool*> mPools;
+    // pools being evicted, and signalled when one is done
+    std::multiset<GraphPool*> mEvicting;
+    std::condition_variable mEvicted;
+
+    uint32_t mIdleEvictions;
+    uint32_t mPressureEvictions;
+    uint64_t mEvictedBytes;
+    uint32_t mRebuilds;
+    Clock::duration mRebuildTime;
+    Clock::duration mMaxRebuildTime;
+
+    std::thread mIdleThread;
+};
+
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_V1_0_HEXAGON_GRAPH_EVICTOR_H
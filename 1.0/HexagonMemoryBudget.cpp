@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "android.hardware.neuralnetworks@1.0-impl-hvx"
+
+#include "HexagonMemoryBudget.h"
+#include <android-base/logging.h>
+#include <android-base/properties.h>
+#include <android-base/stringprintf.h>
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+
+namespace {
+
+std::string toMiB(uint64_t bytes) {
+    return ::android::base::StringPrintf("%.1f MiB", bytes / (1024.0 * 1024.0));
+}
+
+}  // anonymous namespace
+
+MemoryBudget::MemoryBudget()
+    : mDspBudget(static_cast<uint64_t>(::android::base::GetUintProperty<uint32_t>(
+                     "vendor.hvx.memory.dsp_budget_mb", 0))
+                 << 20),
+      mDspBytes(0),
+      mRejected(0) {}
+
+MemoryBudget& MemoryBudget::getInstance() {
+    static MemoryBudget instance{};
+    return instance;
+}
+
+void MemoryBudget::setDspBudgetForTesting(uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mDspBudget = bytes;
+}
+
+bool MemoryBudget::fits(uint64_t dspBytes) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mDspBudget == 0 || mDspBytes + dspBytes <= mDspBudget;
+}
+
+bool MemoryBudget::reserve(const void* owner, uint64_t dspBytes) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mDspBudget != 0 && mDspBytes + dspBytes > mDspBudget) {
+        ++mRejected;
+        LOG(ERROR) << "Graph needs " << toMiB(dspBytes) << " of DSP memory, but only "
+                   << toMiB(mDspBudget - std::min(mDspBudget, mDspBytes)) << " of the "
+                   << toMiB(mDspBudget) << " budget are left";
+        return false;
+    }
+    mDspBytes += dspBytes;
+    mUsage[owner].dspBytes += dspBytes;
+    return true;
+}
+
+void MemoryBudget::release(const void* owner, uint64_t dspBytes) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mUsage.find(owner);
+    if (it == mUsage.end()) {
+        return;
+    }
+    dspBytes = std::min(dspBytes, it->second.dspBytes);
+    it->second.dspBytes -= dspBytes;
+    mDspBytes -= dspBytes;
+}
+
+void MemoryBudget::setHostBytes(const void* owner, uint64_t hostBytes) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mUsage[owner].hostBytes = hostBytes;
+}
+
+void MemoryBudget::forget(const void* owner) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mUsage.find(owner);
+    if (it == mUsage.end()) {
+        return;
+    }
+    mDspBytes -= it->second.dspBytes;
+    mUsage.erase(it);
+}
+
+std::string MemoryBudget::dump() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    uint64_t hostBytes = 0;
+    std::string models;
+    for (const auto& usage : mUsage) {
+        hostBytes += usage.second.hostBytes;
+        models += ::android::base::StringPrintf("  %p: host %s, dsp %s\n", usage.first,
+                                                toMiB(usage.second.hostBytes).c_str(),
+                                                toMiB(usage.second.dspBytes).c_str());
+    }
+    return "memory:\n  host: " + toMiB(hostBytes) + "\n  dsp: " + toMiB(mDspBytes) + " of " +
+           (mDspBudget != 0 ? toMiB(mDspBudget) : "unlimited") +
+           "\n  rejected graphs: " + std::to_string(mRejected) + "\n" + models;
+}
+
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_V1_0_HEXAGON_MEMORY_BUDGET_H
+#define ANDROID_HARDWARE_V1_0_HEXAGON_MEMORY_BUDGET_H
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+
+// Accounts for the memory held by each prepared model: host bytes (graph
+// recipes, mapped pools, staging buffers) and DSP bytes (constants and
+// activation buffers of every materialized graph). DSP memory is reserved
+// before a graph is materialized, against a device-wide budget
+// (vendor.hvx.memory.dsp_budget_mb, unlimited if 0), so that an oversized
+// model fails before nnlib spends time building it.
+class MemoryBudget {
+    // methods
+   private:
+    MemoryBudget();
+    ~MemoryBudget() = default;
+    MemoryBudget(const MemoryBudget&) = delete;
+    MemoryBudget(MemoryBudget&&) = delete;
+    MemoryBudget& operator=(const MemoryBudget&) = delete;
+    MemoryBudget& operator=(MemoryBudget&&) = delete;
+
+   public:
+    static MemoryBudget& getInstance();
+
+    // replaces vendor.hvx.memory.dsp_budget_mb, for the tests
+    void setDspBudgetForTesting(uint64_t bytes);
+
+    bool fits(uint64_t dspBytes);
+
+    // Returns false, and reserves nothing, if the budget would be exceeded.
+    bool reserve(const void* owner, uint64_t dspBytes);
+    void release(const void* owner, uint64_t dspBytes);
+
+    void setHostBytes(const void* owner, uint64_t hostBytes);
+    void forget(const void* owner);
+
+    std::string dump();
+
+    // members
+   private:
+    struct Usage {
+        uint64_t hostBytes;
+        uint64_t dspBytes;
+    };
+
+    std::mutex mMutex;
+    uint64_t mDspBudget;
+    uint64_t mDspBytes;
+    uint32_t mRejected;
+    std::map<const void*, Usage> mUsage;
+};
+
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_V1_0_HEXAGON_MEMORY_BUDGET_H
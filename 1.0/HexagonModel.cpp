@@ -17,9 +17,18 @@
 #define LOG_TAG "android.hardware.neuralnetworks@1.0-impl-hvx"
 
 #include "HexagonModel.h"
+#include <android-base/properties.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
 #include <numeric>
+#include <unordered_map>
 #include <unordered_set>
+#include "HexagonDispatcher.h"
+#include "HexagonMemoryBudget.h"
 #include "HexagonOperations.h"
+#include "HexagonPowerManager.h"
+#include "HexagonWatchdog.h"
 
 namespace android {
 namespace hardware {
@@ -28,27 +37,14 @@ namespace V1_0 {
 namespace implementation {
 namespace hexagon {
 
-static std::vector<OperandInfo> getOperandsInfo(const NeuralnetworksModel& model,
-                                                const std::vector<RunTimePoolInfo>& pools) {
-    std::vector<OperandInfo> info(model.operands.size());
-    for (size_t i = 0; i < model.operands.size(); ++i) {
-        const Operand& operand = model.operands[i];
-        info[i] = {
-            .type = operand.type,
-            .dimensions = operand.dimensions,
-            .scale = operand.scale,
-            .zeroPoint = operand.zeroPoint,
-            .lifetime = operand.lifetime,
-            .buffer = const_cast<uint8_t*>(getData(operand, model.operandValues, pools)),
-            .length = operand.location.length,
-        };
-    }
-    return info;
-}
-
-Model::Model(const NeuralnetworksModel& model) : mGraphId(0), mNodeCount(0), mCompiled(false) {
+static size_t getMaxReplicas() {
+    return ::android::base::GetUintProperty<size_t>("vendor.hvx.graph_replicas", 1);
+}
+
+Model::Model(const NeuralnetworksModel& model)
+    : mReplicas(this, getMaxReplicas()), mCompiled(false), mExecuteMicros(0) {
     mPools = mapPools(model.pools);
-    mOperands = getOperandsInfo(model, mPools);
+    mOperands.assign(model, mPools);
     std::for_each(mPools.begin(), mPools.end(), [](RunTimePoolInfo& mem) { mem.update(); });
 
     mOperations = model.operations;
@@ -56,35 +52,62 @@ Model::Model(const NeuralnetworksModel& model) : mGraphId(0), mNodeCount(0), mCo
     mOutputs = model.outputIndexes;
 }
 
-Model::Model(Model&& other) {
-    *this = std::move(other);
-}
+Model::Model() : mReplicas(this, getMaxReplicas()), mCompiled(false), mExecuteMicros(0) {}
 
-Model& Model::operator=(Model&& other) {
-    if (this != &other) {
-        mNodeCount = other.mNodeCount;
-        mGraphId = other.mGraphId;
-        mCompiled = other.mCompiled;
-        mOperands = std::move(other.mOperands);
-        mOperations = std::move(other.mOperations);
-        mInputs = std::move(other.mInputs);
-        mOutputs = std::move(other.mOutputs);
-        mPools = std::move(other.mPools);
-        other.mNodeCount = 0;
-        other.mGraphId = {};
-        other.mCompiled = false;
-    }
-    return *this;
+std::shared_ptr<Model> Model::restore(Graph graph, std::vector<hexagon_nn_tensordef> inputs,
+                                      std::vector<hexagon_nn_tensordef> outputs) {
+    std::shared_ptr<Model> model(new Model());
+    model->mGraph = std::move(graph);
+    model->mInputTemplates = std::move(inputs);
+    model->mOutputTemplates = std::move(outputs);
+    return model->materialize() ? model : nullptr;
 }
 
 Model::~Model() {
     clearModel();
+    MemoryBudget::getInstance().forget(this);
+}
+
+void Model::compact() {
+    // The graph recipe holds its own copy of the constants, needed again
+    // whenever the graph is rebuilt. It is moved to a shared memory mapping,
+    // so that between rebuilds it costs memory the kernel can swap out
+    // rather than heap. Constants restored from the compilation cache are
+    // mapped from the cache entry already, and stay there.
+    mGraph.seal();
+    std::vector<Operation>().swap(mOperations);
+    std::vector<std::vector<uint8_t>>().swap(mFoldedValues);
+    mOperands = OperandTable{};
+    std::vector<RunTimePoolInfo>().swap(mPools);
+    updateHostBytes();
+}
+
+void Model::shareConstants(const Model& other) {
+    mGraph.shareConstants(other.mGraph);
+}
+
+void Model::evict() {
+    mReplicas.evict();
+}
+
+void Model::updateHostBytes() {
+    uint64_t bytes = mGraph.getHostBytes() + mOperands.getHostBytes() +
+                     mOperations.capacity() * sizeof(Operation) +
+                     (mInputTemplates.capacity() + mOutputTemplates.capacity()) *
+                         sizeof(hexagon_nn_tensordef);
+    for (const RunTimePoolInfo& pool : mPools) {
+        bytes += pool.hidlMemory.size();
+    }
+    for (const std::vector<uint8_t>& values : mFoldedValues) {
+        bytes += values.capacity();
+    }
+    MemoryBudget::getInstance().setHostBytes(this, bytes);
 }
 
 std::string Model::getLog() {
     char buffer[16 * 1024];
     int err = hexagon::Controller::getInstance().getlog(
-        mGraphId, reinterpret_cast<uint8_t*>(buffer), sizeof(buffer));
+        mReplicas.peek(), reinterpret_cast<uint8_t*>(buffer), sizeof(buffer));
     HEXAGON_SOFT_ASSERT_EQ(0, err, "failed getLog");
     return buffer;
 }
@@ -92,50 +115,41 @@ std::string Model::getLog() {
 std::string Model::getGraph() {
     char buffer[16 * 1024];
     int err = hexagon::Controller::getInstance().snpprint(
-        mGraphId, reinterpret_cast<uint8_t*>(buffer), sizeof(buffer));
+        mReplicas.peek(), reinterpret_cast<uint8_t*>(buffer), sizeof(buffer));
     HEXAGON_SOFT_ASSERT_EQ(0, err, "failed getGraph");
     return buffer;
 }
 
-uint32_t Model::getNextNode() {
-    return ++mNodeCount;
-}
-
 const int32_t* Model::getPointer(uint32_t operand) {
-    return reinterpret_cast<const int32_t*>(mOperands[operand].buffer);
+    return reinterpret_cast<const int32_t*>(mOperands.buffer(operand));
 }
 
 Shape Model::getShape(uint32_t operand) {
     return {
-        .type = mOperands[operand].type,
-        .dimensions = mOperands[operand].dimensions,
-        .scale = mOperands[operand].scale,
-        .offset = mOperands[operand].zeroPoint,
+        .type = mOperands.type(operand),
+        .dimensions = mOperands.dimensions(operand).toVector(),
+        .scale = mOperands.scale(operand),
+        .offset = mOperands.zeroPoint(operand),
     };
 }
 
 bool Model::setShape(uint32_t operand, const Shape& shape) {
-    const hexagon_nn_output& output = mOperands[operand].hexagon_output;
-    HEXAGON_SOFT_ASSERT_EQ(output, hexagon_nn_output{}, "Output has already been set");
-    // mOperands[operand].type       = shape.type;
-    mOperands[operand].dimensions = shape.dimensions;
-    // mOperands[operand].scale      = shape.scale;
-    // mOperands[operand].zeroPoint  = shape.offset;
+    const hexagon_nn_input& output = mOperands.hexagon(operand).tensor;
+    HEXAGON_SOFT_ASSERT_EQ(output, hexagon_nn_input{}, "Output has already been set");
+    // type, scale and zeroPoint are kept as declared
+    mOperands.setDimensions(operand, Dimensions(shape.dimensions));
     return true;
 }
 
 bool Model::isConstant(uint32_t operand) {
-    OperandLifeTime lifetime = mOperands[operand].lifetime;
+    OperandLifeTime lifetime = mOperands.lifetime(operand);
     return lifetime == OperandLifeTime::CONSTANT_COPY ||
            lifetime == OperandLifeTime::CONSTANT_REFERENCE;
 }
 
 hexagon_nn_input Model::createTensorInternal(uint32_t B, uint32_t H, uint32_t W, uint32_t D,
                                              const uint8_t* ptr, size_t size) {
-    uint32_t node = getNextNode();
-    bool success = hexagon::Controller::getInstance().append_const_node(mGraphId, node, B, H, W, D,
-                                                                        ptr, size) == 0;
-    HEXAGON_SOFT_ASSERT(success, "Failed to create tensor");
+    uint32_t node = mGraph.addConstNode(B, H, W, D, ptr, size);
     return {.src_id = node, .output_idx = 0};
 }
 
@@ -145,17 +159,18 @@ hexagon_nn_input Model::createShape(uint32_t B, uint32_t H, uint32_t W, uint32_t
 }
 
 hexagon_nn_input Model::addOperand(uint32_t operandIndex) {
-    const OperandInfo& operand = mOperands[operandIndex];
-    std::vector<uint32_t> dims = getAlignedDimensions(operand.dimensions, 4);
-    HEXAGON_SOFT_ASSERT_NE(0ul, dims.size(), "Rank must be at most 4");
+    HEXAGON_SOFT_ASSERT_GE(4u, mOperands.dimensions(operandIndex).size(),
+                           "Rank must be at most 4");
+    const std::array<uint32_t, 4> dims = mOperands.dimensions(operandIndex).aligned();
     hexagon_nn_input result =
-        createTensorInternal(dims[0], dims[1], dims[2], dims[3], operand.buffer, operand.length);
+        createTensorInternal(dims[0], dims[1], dims[2], dims[3], mOperands.buffer(operandIndex),
+                             mOperands.length(operandIndex));
     HEXAGON_SOFT_ASSERT_NE(hexagon_nn_input{}, result, "Failed to add operand");
     return result;
 }
 
 const hexagon_nn_input& Model::getTensor(uint32_t operand) {
-    hexagon_nn_input& tensor = mOperands[operand].hexagon_input;
+    hexagon_nn_input& tensor = mOperands.hexagon(operand).tensor;
     if (tensor == hexagon_nn_input{}) {
         tensor = addOperand(operand);
     }
@@ -163,27 +178,29 @@ const hexagon_nn_input& Model::getTensor(uint32_t operand) {
 }
 
 const hexagon_nn_input& Model::getQuantizationMin(uint32_t operand) {
-    OperandInfo& operandInfo = mOperands[operand];
-    if (operandInfo.hexagon_input_min == hexagon_nn_input{}) {
+    hexagon_nn_input& tensor = mOperands.hexagon(operand).min;
+    if (tensor == hexagon_nn_input{}) {
+        const float scale = mOperands.scale(operand);
         float real_value =
-            operandInfo.type == OperandType::TENSOR_QUANT8_ASYMM
-                ? (std::numeric_limits<uint8_t>::min() - operandInfo.zeroPoint) * operandInfo.scale
-                : std::numeric_limits<uint32_t>::min() * operandInfo.scale;
-        operandInfo.hexagon_input_min = createValues<float>({real_value});
+            mOperands.type(operand) == OperandType::TENSOR_QUANT8_ASYMM
+                ? (std::numeric_limits<uint8_t>::min() - mOperands.zeroPoint(operand)) * scale
+                : std::numeric_limits<uint32_t>::min() * scale;
+        tensor = createValues<float>({real_value});
     }
-    return operandInfo.hexagon_input_min;
+    return tensor;
 }
 
 const hexagon_nn_input& Model::getQuantizationMax(uint32_t operand) {
-    OperandInfo& operandInfo = mOperands[operand];
-    if (operandInfo.hexagon_input_max == hexagon_nn_input{}) {
+    hexagon_nn_input& tensor = mOperands.hexagon(operand).max;
+    if (tensor == hexagon_nn_input{}) {
+        const float scale = mOperands.scale(operand);
         float real_value =
-            operandInfo.type == OperandType::TENSOR_QUANT8_ASYMM
-                ? (std::numeric_limits<uint8_t>::max() - operandInfo.zeroPoint) * operandInfo.scale
-                : std::numeric_limits<uint32_t>::max() * operandInfo.scale;
-        operandInfo.hexagon_input_max = createValues<float>({real_value});
+            mOperands.type(operand) == OperandType::TENSOR_QUANT8_ASYMM
+                ? (std::numeric_limits<uint8_t>::max() - mOperands.zeroPoint(operand)) * scale
+                : std::numeric_limits<uint32_t>::max() * scale;
+        tensor = createValues<float>({real_value});
     }
-    return operandInfo.hexagon_input_max;
+    return tensor;
 }
 
 hexagon_nn_padding_type Model::getPadding(uint32_t operand) {
@@ -192,61 +209,57 @@ hexagon_nn_padding_type Model::getPadding(uint32_t operand) {
 }
 
 hexagon_nn_input Model::createQuantizationValue(uint32_t operand, int32_t quant_value) {
-    OperandInfo& operandInfo = mOperands[operand];
-    float real_value = (quant_value - operandInfo.zeroPoint) * operandInfo.scale;
+    float real_value = (quant_value - mOperands.zeroPoint(operand)) * mOperands.scale(operand);
     return createValues<float>({real_value});
 }
 
 hexagon_nn_input Model::createConvFilterTensor(uint32_t operand) {
-    OperandInfo& operandInfo = mOperands[operand];
-    std::vector<uint32_t> dims = getAlignedDimensions(mOperands[operand].dimensions, 4);
-    HEXAGON_SOFT_ASSERT_NE(0ul, dims.size(), "Need at most 4 dimensions");
+    HEXAGON_SOFT_ASSERT_GE(4u, mOperands.dimensions(operand).size(), "Need at most 4 dimensions");
+    const std::array<uint32_t, 4> dims = mOperands.dimensions(operand).aligned();
+    uint8_t* buffer = mOperands.buffer(operand);
+    const uint32_t length = mOperands.length(operand);
     // NHWC --> HWCN
-    if (getShape(operand).type == OperandType::TENSOR_FLOAT32) {
+    if (mOperands.type(operand) == OperandType::TENSOR_FLOAT32) {
         std::vector<float> transposed =
             transpose<float>(dims[0], dims[1] * dims[2] * dims[3],
-                             reinterpret_cast<const float*>(operandInfo.buffer));
+                             reinterpret_cast<const float*>(buffer));
         return createTensorInternal(dims[1], dims[2], dims[3], dims[0],
-                                    reinterpret_cast<const uint8_t*>(transposed.data()),
-                                    operandInfo.length);
+                                    reinterpret_cast<const uint8_t*>(transposed.data()), length);
     } else {
         std::vector<uint8_t> transposed =
-            transpose<uint8_t>(dims[0], dims[1] * dims[2] * dims[3],
-                               reinterpret_cast<const uint8_t*>(operandInfo.buffer));
+            transpose<uint8_t>(dims[0], dims[1] * dims[2] * dims[3], buffer);
         return createTensorInternal(dims[1], dims[2], dims[3], dims[0],
-                                    reinterpret_cast<const uint8_t*>(transposed.data()),
-                                    operandInfo.length);
+                                    reinterpret_cast<const uint8_t*>(transposed.data()), length);
     }
 }
 
 hexagon_nn_input Model::createDepthwiseFilterTensor(uint32_t operand, int32_t depth_multiplier) {
-    OperandInfo& operandInfo = mOperands[operand];
-    std::vector<uint32_t> dims = getAlignedDimensions(mOperands[operand].dimensions, 4);
-    HEXAGON_SOFT_ASSERT_NE(0ul, dims.size(), "Need at most 4 dimensions");
+    HEXAGON_SOFT_ASSERT_GE(4u, mOperands.dimensions(operand).size(), "Need at most 4 dimensions");
+    const std::array<uint32_t, 4> dims = mOperands.dimensions(operand).aligned();
+    uint8_t* buffer = mOperands.buffer(operand);
+    const uint32_t length = mOperands.length(operand);
     // NHWC --> HWCN
     return createTensorInternal(dims[1], dims[2], dims[3] / depth_multiplier,
-                                dims[0] * depth_multiplier, operandInfo.buffer, operandInfo.length);
+                                dims[0] * depth_multiplier, buffer, length);
 }
 
 hexagon_nn_input Model::createFullyConnectedWeightTensor(uint32_t operand) {
-    OperandInfo& operandInfo = mOperands[operand];
-    std::vector<uint32_t> dims = getAlignedDimensions(mOperands[operand].dimensions, 4);
-    HEXAGON_SOFT_ASSERT_NE(0ul, dims.size(), "Need at most 4 dimensions");
+    HEXAGON_SOFT_ASSERT_GE(4u, mOperands.dimensions(operand).size(), "Need at most 4 dimensions");
+    const std::array<uint32_t, 4> dims = mOperands.dimensions(operand).aligned();
+    uint8_t* buffer = mOperands.buffer(operand);
+    const uint32_t length = mOperands.length(operand);
     // WC --> CW
     uint32_t num_units = dims[0] * dims[1] * dims[2];
     uint32_t input_size = dims[3];
-    if (getShape(operand).type == OperandType::TENSOR_FLOAT32) {
-        std::vector<float> transposed = transpose<float>(
-            num_units, input_size, reinterpret_cast<const float*>(operandInfo.buffer));
+    if (mOperands.type(operand) == OperandType::TENSOR_FLOAT32) {
+        std::vector<float> transposed =
+            transpose<float>(num_units, input_size, reinterpret_cast<const float*>(buffer));
         return createTensorInternal(1, 1, input_size, num_units,
-                                    reinterpret_cast<const uint8_t*>(transposed.data()),
-                                    operandInfo.length);
+                                    reinterpret_cast<const uint8_t*>(transposed.data()), length);
     } else {
-        std::vector<uint8_t> transposed = transpose<uint8_t>(
-            num_units, input_size, reinterpret_cast<const uint8_t*>(operandInfo.buffer));
+        std::vector<uint8_t> transposed = transpose<uint8_t>(num_units, input_size, buffer);
         return createTensorInternal(1, 1, input_size, num_units,
-                                    reinterpret_cast<const uint8_t*>(transposed.data()),
-                                    operandInfo.length);
+                                    reinterpret_cast<const uint8_t*>(transposed.data()), length);
     }
 }
 
@@ -283,20 +296,16 @@ uint32_t Model::addOperationInternal(op_type op, hexagon_nn_padding_type pad,
                         "error adding operation: one or more inputs is invalid");
     HEXAGON_SOFT_ASSERT(verifyOperationOutputs(outputs),
                         "error adding operation: one or more outputs is invalid");
-    uint32_t node = getNextNode();
-    return hexagon::Controller::getInstance().append_node(mGraphId, node, op, pad, inputs.data(),
-                                                          inputs.size(), outputs.data(),
-                                                          outputs.size()) == 0
-               ? node
-               : 0;
+    return mGraph.addNode(op, pad, inputs, outputs);
 }
 
 std::vector<hexagon_nn_output> Model::getHexagonOutputs(const std::vector<uint32_t>& operands) {
     std::vector<hexagon_nn_output> outputs;
     for (uint32_t index : operands) {
-        const OperandInfo& operand = mOperands[index];
-        outputs.push_back(make_hexagon_nn_output(operand.dimensions, getSize(operand.type)));
-        if (operand.type == OperandType::TENSOR_QUANT8_ASYMM) {
+        const OperandType type = mOperands.type(index);
+        outputs.push_back(
+            make_hexagon_nn_output(mOperands.dimensions(index).toVector(), getSize(type)));
+        if (type == OperandType::TENSOR_QUANT8_ASYMM) {
             outputs.push_back(make_hexagon_nn_output({1, 1, 1, 1}, sizeof(float)));
             outputs.push_back(make_hexagon_nn_output({1, 1, 1, 1}, sizeof(float)));
         }
@@ -307,13 +316,13 @@ std::vector<hexagon_nn_output> Model::getHexagonOutputs(const std::vector<uint32
 bool Model::registerHexagonInputs(const std::vector<uint32_t>& operands, uint32_t node) {
     uint32_t idx = 0;
     for (uint32_t i = 0; i < static_cast<uint32_t>(operands.size()); ++i) {
-        OperandInfo& operand = mOperands[operands[i]];
-        HEXAGON_SOFT_ASSERT_EQ(operand.hexagon_input, hexagon_nn_input{},
+        HexagonTensors& tensors = mOperands.hexagon(operands[i]);
+        HEXAGON_SOFT_ASSERT_EQ(tensors.tensor, hexagon_nn_input{},
                                "Error: operation output has already been registered");
-        operand.hexagon_input = {.src_id = node, .output_idx = idx++};
-        if (operand.type == OperandType::TENSOR_QUANT8_ASYMM) {
-            operand.hexagon_input_min = {.src_id = node, .output_idx = idx++};
-            operand.hexagon_input_max = {.src_id = node, .output_idx = idx++};
+        tensors.tensor = {.src_id = node, .output_idx = idx++};
+        if (mOperands.type(operands[i]) == OperandType::TENSOR_QUANT8_ASYMM) {
+            tensors.min = {.src_id = node, .output_idx = idx++};
+            tensors.max = {.src_id = node, .output_idx = idx++};
         }
     }
     return true;
@@ -425,10 +434,9 @@ bool Model::addFusedQuant8Operation(op_type op, hexagon_nn_padding_type pad,
     const hexagon_nn_input& new_max = getQuantizationMax(outputs[0]);
     uint32_t node;
 
-    hexagon_nn_output tensor_out8 =
-        make_hexagon_nn_output(mOperands[outputs[0]].dimensions, sizeof(uint8_t));
-    hexagon_nn_output tensor_out32 =
-        make_hexagon_nn_output(mOperands[outputs[0]].dimensions, sizeof(int32_t));
+    const std::vector<uint32_t> dims = mOperands.dimensions(outputs[0]).toVector();
+    hexagon_nn_output tensor_out8 = make_hexagon_nn_output(dims, sizeof(uint8_t));
+    hexagon_nn_output tensor_out32 = make_hexagon_nn_output(dims, sizeof(int32_t));
     hexagon_nn_output scalar_out32 = make_hexagon_nn_output({1, 1, 1, 1}, sizeof(float));
 
     std::vector<hexagon_nn_output> out8 = {tensor_out8, scalar_out32, scalar_out32};
@@ -476,23 +484,261 @@ bool Model::verifyOperations() {
     return std::all_of(supported.begin(), supported.end(), [](bool valid) { return valid; });
 }
 
-bool Model::verifyOperands() {
-    for (const OperandInfo& operand : mOperands) {
-        HEXAGON_SOFT_ASSERT_GE(4ul, operand.dimensions.size(),
-                               "Operand must have at most 4 dimensions");
-        for (uint32_t dim : operand.dimensions) {
+bool Model::verifyOperands(bool allowUnknownDimensions) {
+    for (uint32_t operand = 0; operand < mOperands.size(); ++operand) {
+        const Dimensions& dimensions = mOperands.dimensions(operand);
+        HEXAGON_SOFT_ASSERT_GE(4u, dimensions.size(), "Operand must have at most 4 dimensions");
+        if (allowUnknownDimensions) {
+            continue;
+        }
+        for (uint32_t dim : dimensions) {
             HEXAGON_SOFT_ASSERT_NE(0, dim, "At least one operand with unknown dimension");
         }
     }
     return true;
 }
 
+bool Model::verifyWithUnknownDimensions() {
+    return verifyOperations() && verifyOperands(true);
+}
+
+namespace {
+
+// Folding is skipped where it would grow the constants by more than this,
+// e.g. broadcasting a small constant into a large one.
+constexpr uint32_t kMaxFoldingGrowth = 64 * 1024;
+
+bool isKnownBeforeExecution(OperandLifeTime lifetime) {
+    return lifetime == OperandLifeTime::CONSTANT_COPY ||
+           lifetime == OperandLifeTime::CONSTANT_REFERENCE ||
+           lifetime == OperandLifeTime::NO_VALUE;
+}
+
+// Operations that see their first input only as rows of its innermost
+// dimension, as nnlib's matrix multiply and softmax do: a reshape that keeps
+// that dimension changes nothing they compute.
+bool readsRowsOfDepth(OperationType type) {
+    return type == OperationType::FULLY_CONNECTED || type == OperationType::SOFTMAX;
+}
+
+uint64_t getElementCount(const Dimensions& dimensions) {
+    return std::accumulate(dimensions.begin(), dimensions.end(), uint64_t{1},
+                           std::multiplies<uint64_t>());
+}
+
+}  // anonymous namespace
+
+bool Model::isFoldable(const Operation& operation) const {
+    uint32_t inputBytes = 0;
+    for (uint32_t input : operation.inputs) {
+        if (!isKnownBeforeExecution(mOperands.lifetime(input))) {
+            return false;
+        }
+        inputBytes += mOperands.length(input);
+    }
+    uint32_t outputBytes = 0;
+    for (uint32_t output : operation.outputs) {
+        // model outputs are still produced by the graph
+        if (mOperands.lifetime(output) != OperandLifeTime::TEMPORARY_VARIABLE) {
+            return false;
+        }
+        outputBytes += mOperands.byteSize(output);
+    }
+    return outputBytes <= inputBytes + kMaxFoldingGrowth;
+}
+
+// Runs the operation on the CPU reference kernels, as a model of its own
+// whose constants are the operation's inputs.
+bool Model::foldOperation(const Operation& operation) {
+    NeuralnetworksModel model;
+    std::vector<Operand> operands;
+    std::vector<uint8_t> values;
+    std::vector<uint32_t> inputs;
+    for (uint32_t input : operation.inputs) {
+        const uint32_t length = mOperands.length(input);
+        const bool hasValue = mOperands.lifetime(input) != OperandLifeTime::NO_VALUE;
+        values.resize((values.size() + 3) & ~3u);
+        operands.push_back({
+            .type = mOperands.type(input),
+            .dimensions = mOperands.dimensions(input).toVector(),
+            .numberOfConsumers = 1,
+            .scale = mOperands.scale(input),
+            .zeroPoint = mOperands.zeroPoint(input),
+            .lifetime = hasValue ? OperandLifeTime::CONSTANT_COPY : OperandLifeTime::NO_VALUE,
+            .location = {.poolIndex = 0,
+                         .offset = static_cast<uint32_t>(values.size()),
+                         .length = hasValue ? length : 0},
+        });
+        if (hasValue) {
+            values.insert(values.end(), mOperands.buffer(input), mOperands.buffer(input) + length);
+        }
+        inputs.push_back(operands.size() - 1);
+    }
+
+    Request request;
+    std::vector<RequestArgument> arguments;
+    std::vector<uint32_t> outputs;
+    uint32_t outputBytes = 0;
+    for (uint32_t output : operation.outputs) {
+        const uint32_t length = mOperands.byteSize(output);
+        operands.push_back({
+            .type = mOperands.type(output),
+            .dimensions = mOperands.dimensions(output).toVector(),
+            .numberOfConsumers = 0,
+            .scale = mOperands.scale(output),
+            .zeroPoint = mOperands.zeroPoint(output),
+            .lifetime = OperandLifeTime::MODEL_OUTPUT,
+            .location = {.poolIndex = 0, .offset = 0, .length = 0},
+        });
+        outputs.push_back(operands.size() - 1);
+        arguments.push_back({
+            .hasNoValue = false,
+            .location = {.poolIndex = 0, .offset = outputBytes, .length = length},
+            .dimensions = {},
+        });
+        outputBytes += (length + 3) & ~3u;
+    }
+
+    model.operands = operands;
+    model.operations = std::vector<Operation>{
+        {.type = operation.type, .inputs = inputs, .outputs = outputs},
+    };
+    model.outputIndexes = outputs;
+    model.operandValues = values;
+    request.outputs = arguments;
+
+    std::vector<uint8_t> results(outputBytes);
+    RunTimePoolInfo resultPool;
+    resultPool.buffer = results.data();
+    ::android::nn::CpuExecutor executor;
+    if (executor.run(model, request, {}, {resultPool}) != ANEURALNETWORKS_NO_ERROR) {
+        LOG(INFO) << "Could not fold " << toString(operation.type);
+        return false;
+    }
+
+    for (size_t i = 0; i < operation.outputs.size(); ++i) {
+        const DataLocation& location = arguments[i].location;
+        mFoldedValues.emplace_back(results.begin() + location.offset,
+                                   results.begin() + location.offset + location.length);
+        mOperands.setConstant(operation.outputs[i], mFoldedValues.back().data(), location.length);
+    }
+    return true;
+}
+
+// Evaluates the operations whose inputs are all constant on the host, so
+// that the graph holds their results as constants rather than recomputing
+// them on every execution. Operations are in topological order, so chains
+// of such operations fold one after the other.
+void Model::foldConstants() {
+    std::vector<Operation> remaining;
+    for (Operation& operation : mOperations) {
+        if (!isFoldable(operation) || !foldOperation(operation)) {
+            remaining.push_back(std::move(operation));
+        }
+    }
+    if (remaining.size() != mOperations.size()) {
+        LOG(INFO) << "Folded " << mOperations.size() - remaining.size() << " of "
+                  << mOperations.size() << " operations into constants";
+    }
+    mOperations.swap(remaining);
+}
+
+// Whether operation, which reads rows of the innermost dimension of its
+// first input, reads the same rows from source.
+bool Model::readsSameRows(const Operation& operation, uint32_t source) const {
+    const Dimensions& reshaped = mOperands.dimensions(operation.inputs[0]);
+    const uint32_t depth = mOperands.dimensions(source).aligned()[3];
+    if (operation.type != OperationType::FULLY_CONNECTED) {
+        return depth == reshaped.aligned()[3];
+    }
+
+    // The input is flattened to [batches, weights.dims[1]], whatever its
+    // shape, while nnlib multiplies the rows of the innermost dimension.
+    const Dimensions& weights = mOperands.dimensions(operation.inputs[1]);
+    if (weights.size() != 2 || weights.values[1] == 0 || depth != weights.values[1]) {
+        return false;
+    }
+    const uint64_t batches = getElementCount(reshaped) / weights.values[1];
+    return getElementCount(mOperands.dimensions(source)) / depth == batches &&
+           reshaped.size() == 2 && reshaped.values[0] == batches;
+}
+
+// Bypasses reshapes where they do not change what is computed, so they cost
+// neither a node nor a copy on the DSP: a reshape of a reshape reads the
+// original data, and operations reading rows of the innermost dimension read
+// the data from before a reshape that keeps those rows. Only reshapes that
+// keep the quantization are bypassed. Reshapes left without readers are
+// removed with the other dead operations.
+void Model::elideReshapes() {
+    // reshaped operand -> operand holding its data before any reshape
+    std::unordered_map<uint32_t, uint32_t> sources;
+    uint32_t bypassed = 0;
+    for (Operation& operation : mOperations) {
+        const auto source = sources.find(operation.inputs[0]);
+        if (operation.type == OperationType::RESHAPE) {
+            if (source != sources.end()) {
+                operation.inputs[0] = source->second;
+                ++bypassed;
+            }
+            // the data is only the same if it is quantized the same
+            if (mOperands.scale(operation.inputs[0]) == mOperands.scale(operation.outputs[0]) &&
+                mOperands.zeroPoint(operation.inputs[0]) ==
+                    mOperands.zeroPoint(operation.outputs[0])) {
+                sources[operation.outputs[0]] = operation.inputs[0];
+            }
+        } else if (readsRowsOfDepth(operation.type) && source != sources.end() &&
+                   readsSameRows(operation, source->second)) {
+            operation.inputs[0] = source->second;
+            ++bypassed;
+        }
+    }
+    if (bypassed > 0) {
+        LOG(INFO) << "Bypassed " << bypassed << " reshapes";
+    }
+}
+
+// Drops the operations none of whose outputs reach a model output, e.g.
+// auxiliary heads left in converted models, and reshapes that were bypassed.
+// Operations are in topological order, so one backward sweep finds every
+// operation that is needed.
+void Model::removeDeadOperations() {
+    std::vector<bool> needed(mOperands.size(), false);
+    for (uint32_t output : mOutputs) {
+        needed[output] = true;
+    }
+
+    std::vector<bool> live(mOperations.size(), false);
+    for (size_t i = mOperations.size(); i-- > 0;) {
+        const Operation& operation = mOperations[i];
+        live[i] = std::any_of(operation.outputs.begin(), operation.outputs.end(),
+                              [&needed](uint32_t output) { return needed[output]; });
+        if (live[i]) {
+            for (uint32_t input : operation.inputs) {
+                needed[input] = true;
+            }
+        }
+    }
+
+    std::vector<Operation> remaining;
+    for (size_t i = 0; i < mOperations.size(); ++i) {
+        if (live[i]) {
+            remaining.push_back(std::move(mOperations[i]));
+        }
+    }
+    if (remaining.size() != mOperations.size()) {
+        LOG(INFO) << "Removed " << mOperations.size() - remaining.size() << " of "
+                  << mOperations.size() << " operations that do not reach an output";
+    }
+    mOperations.swap(remaining);
+}
+
 bool Model::addInputs() {
     // prepare OP_INPUT's outputs
     std::vector<hexagon_nn_output> outs;
     for (size_t i = 0; i < mInputs.size(); ++i) {
-        OperandInfo& operand = mOperands[mInputs[i]];
-        outs.push_back(make_hexagon_nn_output(operand.dimensions, getSize(operand.type)));
+        const uint32_t operand = mInputs[i];
+        outs.push_back(make_hexagon_nn_output(mOperands.dimensions(operand).toVector(),
+                                              getSize(mOperands.type(operand))));
     }
 
     // add single input node for entire graph
@@ -501,8 +747,8 @@ bool Model::addInputs() {
 
     // update operand information
     for (size_t i = 0; i < mInputs.size(); ++i) {
-        OperandInfo& operand = mOperands[mInputs[i]];
-        operand.hexagon_input = {.src_id = node, .output_idx = static_cast<uint32_t>(i)};
+        mOperands.hexagon(mInputs[i]).tensor = {.src_id = node,
+                                                .output_idx = static_cast<uint32_t>(i)};
     }
 
     return true;
@@ -515,7 +761,7 @@ bool Model::addOperations() {
         // For now, the operation type is always the same as its first operand
         // parameter. If this changes in the future, this line of code will need
         // to be updated.
-        OperandType operandType = mOperands[operation.inputs[0]].type;
+        OperandType operandType = mOperands.type(operation.inputs[0]);
 
         OperationTuple opTuple = std::make_pair(operationType, operandType);
         HEXAGON_SOFT_ASSERT(
@@ -531,28 +777,29 @@ bool Model::addOperations() {
 bool Model::addOutputs() {
     // prepare OP_OUTPUT's inputs
     std::vector<hexagon_nn_input> ins;
-    for (size_t out : mOutputs) {
-        OperandInfo& operand = mOperands[out];
-        HEXAGON_SOFT_ASSERT_NE(operand.hexagon_input, hexagon_nn_input{},
+    for (uint32_t out : mOutputs) {
+        const HexagonTensors& tensors = mOperands.hexagon(out);
+        HEXAGON_SOFT_ASSERT_NE(tensors.tensor, hexagon_nn_input{},
                                "output operand has not been registered");
 
-        if (operand.type == OperandType::TENSOR_QUANT8_ASYMM) {
+        if (mOperands.type(out) == OperandType::TENSOR_QUANT8_ASYMM) {
             // Adjust quantized range of outputs
-            uint32_t dequant = addOperationInternal(
-                OP_Dequantize, NN_PAD_NA,
-                {operand.hexagon_input, operand.hexagon_input_min, operand.hexagon_input_max},
-                {make_hexagon_nn_output(operand.dimensions, sizeof(float))});
+            const std::vector<uint32_t> dims = mOperands.dimensions(out).toVector();
+            uint32_t dequant =
+                addOperationInternal(OP_Dequantize, NN_PAD_NA,
+                                     {tensors.tensor, tensors.min, tensors.max},
+                                     {make_hexagon_nn_output(dims, sizeof(float))});
             uint32_t quant =
                 addOperationInternal(OP_Quantize, NN_PAD_NA,
                                      {{.src_id = dequant, .output_idx = 0},
                                       createQuantizationValue(out, 0),
                                       createQuantizationValue(out, 255)},
-                                     {make_hexagon_nn_output(operand.dimensions, sizeof(uint8_t)),
+                                     {make_hexagon_nn_output(dims, sizeof(uint8_t)),
                                       make_hexagon_nn_output({1, 1, 1, 1}, sizeof(float)),
                                       make_hexagon_nn_output({1, 1, 1, 1}, sizeof(float))});
             ins.push_back({.src_id = quant, .output_idx = 0});
         } else {
-            ins.push_back(operand.hexagon_input);
+            ins.push_back(tensors.tensor);
         }
     }
 
@@ -565,15 +812,9 @@ bool Model::addOutputs() {
 
 void Model::clearModel() {
     mCompiled = false;
-    for (OperandInfo& operand : mOperands) {
-        operand.hexagon_input = {};
-        operand.hexagon_input_min = {};
-        operand.hexagon_input_max = {};
-        operand.hexagon_output = {};
-    }
-    if (mGraphId != hexagon_nn_nn_id{}) {
-        hexagon::Controller::getInstance().teardown(mGraphId);
-    }
+    mOperands.clearHexagon();
+    mReplicas.clear();
+    mGraph.clear();
 }
 
 std::vector<bool> Model::supportedOperations() {
@@ -585,7 +826,7 @@ std::vector<bool> Model::supportedOperations() {
         // For now, the operation type is always the same as its first operand
         // parameter. If this changes in the future, this line of code will need
         // to be updated.
-        OperandType operandType = mOperands[operation.inputs[0]].type;
+        OperandType operandType = mOperands.type(operation.inputs[0]);
 
         OperationTuple opTuple = std::make_pair(operationType, operandType);
 
@@ -603,88 +844,202 @@ bool Model::prepare() {
     if (!verifyOperations() || !verifyOperands()) {
         return false;
     }
-
-    int err = hexagon::Controller::getInstance().init(&mGraphId);
-    HEXAGON_SOFT_ASSERT_EQ(0, err, "Hexagon could not allocate new graph");
-    HEXAGON_SOFT_ASSERT_NE(0, mGraphId, "Hexagon could not allocate new graph");
-    hexagon::Controller::getInstance().set_debug_level(mGraphId, 0);
+    // dead operations are found in the graph as it is lowered, after folding
+    elideReshapes();
+    foldConstants();
+    removeDeadOperations();
 
     if (!addInputs() || !addOperations() || !addOutputs()) {
         clearModel();
         LOG(ERROR) << "Something went wrong. Clearing the model and aborting.";
         return false;
     }
+    mGraph.schedule();
 
-    err = hexagon::Controller::getInstance().prepare(mGraphId);
+    mInputTemplates = createTemplates(mInputs);
+    mOutputTemplates = createTemplates(mOutputs);
+    return materialize();
+}
 
-    LOG(INFO) << "PrepareModel was " << (err == 0 ? "SUCCESSFUL" : "UNSUCCESSFUL");
+bool Model::materialize() {
+    updateHostBytes();
 
-    return err == 0;
+    PowerManager::Vote vote;
+    mCompiled = mReplicas.initialize(mGraph);
+
+    LOG(INFO) << "PrepareModel was " << (mCompiled ? "SUCCESSFUL" : "UNSUCCESSFUL");
+
+    return mCompiled;
 }
 
-static hexagon_nn_tensordef convertToTensordef(const OperandInfo& operand) {
-    std::vector<uint32_t> dimensions = getAlignedDimensions(operand.dimensions, 4);
+static hexagon_nn_tensordef convertToTensordef(const Dimensions& operand, uint32_t length) {
+    const std::array<uint32_t, 4> dimensions = operand.aligned();
     return {
         .batches = dimensions[0],
         .height = dimensions[1],
         .width = dimensions[2],
         .depth = dimensions[3],
-        .data = operand.buffer,
-        .dataLen = static_cast<int32_t>(operand.length),
-        .data_valid_len = operand.length,  // unused?
+        .data = nullptr,
+        .dataLen = static_cast<int32_t>(length),
+        .data_valid_len = length,  // unused?
         .unused = 0,
     };
 }
 
-static uint32_t getSize(const OperandInfo& operand) {
-    return std::accumulate(operand.dimensions.begin(), operand.dimensions.end(),
-                           getSize(operand.type), std::multiplies<>{});
+std::vector<hexagon_nn_tensordef> Model::createTemplates(const std::vector<uint32_t>& operands) {
+    std::vector<hexagon_nn_tensordef> templates;
+    for (uint32_t operand : operands) {
+        templates.push_back(
+            convertToTensordef(mOperands.dimensions(operand), mOperands.byteSize(operand)));
+    }
+    return templates;
+}
+
+// binds an argument to the prepared tensordef of its operand
+static bool bindArgument(const RequestArgument& argument, const MappedPools& pools,
+                         hexagon_nn_tensordef* tensor) {
+    HEXAGON_SOFT_ASSERT_LT(argument.location.poolIndex, pools.size(), "Invalid pool index");
+
+    // the shape only changes for a dimension override, which is rare
+    if (argument.dimensions.size() > 0) {
+        const Dimensions dimensions(argument.dimensions);
+        HEXAGON_SOFT_ASSERT_GE(4u, dimensions.size(), "Rank must be at most 4");
+        const uint32_t elementSize = tensor->data_valid_len / (tensor->batches * tensor->height *
+                                                               tensor->width * tensor->depth);
+        const uint32_t length = std::accumulate(dimensions.begin(), dimensions.end(), elementSize,
+                                                std::multiplies<>{});
+        *tensor = convertToTensordef(dimensions, length);
+    }
+
+    tensor->data = pools[argument.location.poolIndex]->buffer + argument.location.offset;
+    return true;
 }
 
-static OperandInfo getUpdatedOperand(const RequestArgument& inputOutput,
-                                     const std::vector<RunTimePoolInfo>& pools,
-                                     const OperandInfo& oldInfo) {
-    OperandInfo newInfo = oldInfo;
+bool Model::bindRequest(const Request& request, const MappedPools& pools, Bindings* bindings) {
+    // assigning into recycled bindings does not allocate
+    bindings->pools = pools;
+
+    // patch the data of the prepared tensordefs
+    bindings->inputs = mInputTemplates;
+    for (size_t i = 0; i < request.inputs.size(); ++i) {
+        HEXAGON_SOFT_ASSERT(bindArgument(request.inputs[i], bindings->pools, &bindings->inputs[i]),
+                            "Error binding input " << i);
+    }
+    bindings->outputs = mOutputTemplates;
+    for (size_t i = 0; i < request.outputs.size(); ++i) {
+        HEXAGON_SOFT_ASSERT(
+            bindArgument(request.outputs[i], bindings->pools, &bindings->outputs[i]),
+            "Error binding output " << i);
+    }
+    return true;
+}
+
+std::shared_ptr<Bindings> Model::acquireBindings() {
+    std::lock_guard<std::mutex> lock(mBindingsMutex);
+    if (mFreeBindings.empty()) {
+        return std::make_shared<Bindings>();
+    }
+    std::shared_ptr<Bindings> bindings = std::move(mFreeBindings.back());
+    mFreeBindings.pop_back();
+    return bindings;
+}
 
-    const RunTimePoolInfo& pool = pools[inputOutput.location.poolIndex];
-    uint32_t offset = inputOutput.location.offset;
+void Model::releaseBindings(std::shared_ptr<Bindings> bindings) {
+    // bindings of an execution abandoned by the watchdog are still in use
+    if (bindings.use_count() != 1) {
+        return;
+    }
+    bindings->pools.clear();
+    std::lock_guard<std::mutex> lock(mBindingsMutex);
+    mFreeBindings.push_back(std::move(bindings));
+}
 
-    if (inputOutput.dimensions.size() > 0) {
-        newInfo.dimensions = inputOutput.dimensions;
+int Model::executeInternal(const std::shared_ptr<Bindings>& bindings, const Client& client,
+                           Timing* timing) {
+    const hexagon_nn_nn_id graphId = mCompiled ? mReplicas.acquire(mGraph) : hexagon_nn_nn_id{};
+    if (graphId == hexagon_nn_nn_id{}) {
+        LOG(ERROR) << "Graph is not available";
+        return -1;
     }
 
-    newInfo.buffer = pool.buffer + offset;
-    newInfo.length = getSize(newInfo);
+    // The call shares the bindings, and keeps the request pools mapped, in
+    // case the watchdog abandons it. Holding only the graph id and the
+    // bindings, it fits the inline storage of std::function.
+    auto execution = [this, graphId, &bindings, timing]() {
+        const auto start = std::chrono::steady_clock::now();
+        // the level can change under a long execution; its start is what the
+        // vote of this execution asked for
+        const uint32_t clockMhz = PowerManager::getInstance().getClockMhz();
+        const int result = Watchdog::getInstance().supervise(
+            "execute_new", Watchdog::getInstance().getExecuteDeadline(), [graphId, bindings]() {
+                return hexagon::Controller::getInstance().execute_new(
+                    graphId, bindings->inputs.data(), bindings->inputs.size(),
+                    bindings->outputs.data(), bindings->outputs.size());
+            });
+        if (result == 0) {
+            // moving average of the DSP time, the cost of the next execution
+            const uint64_t sample = std::chrono::duration_cast<std::chrono::microseconds>(
+                                        std::chrono::steady_clock::now() - start)
+                                        .count();
+            const uint64_t average = mExecuteMicros;
+            mExecuteMicros = average == 0 ? sample : (7 * average + sample) / 8;
+        }
+        // read back before the replica can be used by another execution
+        unsigned int cyclesLo = 0;
+        unsigned int cyclesHi = 0;
+        if (result == 0 && timing != nullptr &&
+            Controller::getInstance().last_execution_cycles(graphId, &cyclesLo, &cyclesHi) == 0) {
+            timing->timeOnDevice = ((static_cast<uint64_t>(cyclesHi) << 32) | cyclesLo) / clockMhz;
+            timing->clockMhz = clockMhz;
+        }
+        return result;
+    };
+    int err = Dispatcher::getInstance().dispatch(client, mExecuteMicros, execution);
 
-    return newInfo;
+    mReplicas.release(graphId);
+    return err;
 }
 
-bool Model::execute(const Request& request) {
-    std::vector<RunTimePoolInfo> pools = mapPools(request.pools);
+bool Model::execute(const Request& request, const Client& client, Timing* timing) {
+    // the memories of a request carry nothing that identifies them across
+    // requests, so their mappings cannot be reused
+    MappedPools pools;
+    HEXAGON_SOFT_ASSERT(mapPools(request.pools, &pools), "Error mapping pools");
+    return execute(request, pools, client, timing);
+}
 
-    // prepare inputs
-    std::vector<hexagon_nn_tensordef> inputs;
-    for (size_t i = 0; i < request.inputs.size(); ++i) {
-        const OperandInfo& oldInfo = mOperands[mInputs[i]];
-        OperandInfo newInfo = getUpdatedOperand(request.inputs[i], pools, oldInfo);
-        inputs.push_back(convertToTensordef(newInfo));
-    }
+bool Model::execute(const Request& request, const MappedPools& pools, const Client& client,
+                    Timing* timing) {
+    HEXAGON_SOFT_ASSERT(mCompiled, "Model is not prepared");
 
-    // prepare outputs
-    std::vector<hexagon_nn_tensordef> outputs;
-    for (size_t i = 0; i < request.outputs.size(); ++i) {
-        const OperandInfo& oldInfo = mOperands[mOutputs[i]];
-        OperandInfo newInfo = getUpdatedOperand(request.outputs[i], pools, oldInfo);
-        outputs.push_back(convertToTensordef(newInfo));
-    }
+    std::shared_ptr<Bindings> bindings = acquireBindings();
+    HEXAGON_SOFT_ASSERT(bindRequest(request, pools, bindings.get()), "Error binding request");
 
     // execute model
-    int err = hexagon::Controller::getInstance().execute_new(mGraphId, inputs.data(), inputs.size(),
-                                                             outputs.data(), outputs.size());
+    if (timing != nullptr) {
+        timing->pid = client.pid;
+    }
+    PowerManager::Vote vote(client.workload);
+    int err = executeInternal(bindings, client, timing);
+    if (err == Watchdog::kTimedOut) {
+        // nnlib was reset underneath this graph, which is rebuilt from its
+        // recipe by the retry. The abandoned execution may still write to
+        // its tensordefs, so the retry binds a set of its own.
+        releaseBindings(std::move(bindings));
+        bindings = acquireBindings();
+        err = -1;
+        if (bindRequest(request, pools, bindings.get())) {
+            err = executeInternal(bindings, client, timing);
+        }
+        Watchdog::getInstance().onRetry(err == 0);
+    }
 
-    std::for_each(pools.begin(), pools.end(), [](RunTimePoolInfo& pool) { pool.update(); });
+    if (err == 0) {
+        syncOutputs(request.outputs, bindings->pools);
+    }
+    releaseBindings(std::move(bindings));
 
-    LOG(INFO) << "EXECUTION WAS " << (err == 0 ? "SUCCESSFUL" : "UNSUCCESSFUL");
+    LOG(VERBOSE) << "EXECUTION WAS " << (err == 0 ? "SUCCESSFUL" : "UNSUCCESSFUL");
 
     return err == 0;
 }
@@ -19,11 +19,17 @@
 
 #include <android/hardware/neuralnetworks/1.0/types.h>
 #include <atomic>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 #include "CpuExecutor.h"
 #include "HexagonController.h"
+#include "HexagonDispatcher.h"
+#include "HexagonGraph.h"
+#include "HexagonOperandTable.h"
 #include "HexagonOperations.h"
+#include "HexagonTiming.h"
 #include "HexagonUtils.h"
 #include "OperationsUtils.h"
 #include "hexagon_nn_controller/hexagon_nn_controller.h"
@@ -40,43 +46,34 @@ using ::android::nn::Shape;
 
 using NeuralnetworksModel = ::android::hardware::neuralnetworks::V1_0::Model;
 
-// runtime operand information
-struct OperandInfo {
-    // tensor information
-    OperandType type;
-    std::vector<uint32_t> dimensions;
-
-    // (optional) quantization paramters
-    float scale;
-    int32_t zeroPoint;
-
-    // lifetime
-    OperandLifeTime lifetime;
-
-    // data location
-    uint8_t* buffer;
-    uint32_t length;
-
-    // Hexagon nnlib identifiers
-    hexagon_nn_input hexagon_input;
-    hexagon_nn_input hexagon_input_min;
-    hexagon_nn_input hexagon_input_max;
-    hexagon_nn_output hexagon_output;
+// arguments of one execution, recycled across executions
+struct Bindings {
+    std::vector<hexagon_nn_tensordef> inputs;
+    std::vector<hexagon_nn_tensordef> outputs;
+    MappedPools pools;
 };
 
 // interface wrapper
 class Model {
+   private:
+    // a model restored from its lowered graph
+    Model();
+
    public:
     // methods
-    Model() = delete;
     Model(const Model&) = delete;
     Model& operator=(const Model&) = delete;
-    Model(Model&& other);
-    Model& operator=(Model&& other);
+    Model(Model&& other) = delete;
+    Model& operator=(Model&& other) = delete;
 
     Model(const NeuralnetworksModel& model);
     ~Model();
 
+    // Materializes a graph lowered earlier, skipping the NNAPI model and all
+    // of the lowering. Returns nullptr on error.
+    static std::shared_ptr<Model> restore(Graph graph, std::vector<hexagon_nn_tensordef> inputs,
+                                          std::vector<hexagon_nn_tensordef> outputs);
+
     std::string getLog();
     std::string getGraph();
 
@@ -131,11 +128,43 @@ class Model {
                                  const std::vector<uint32_t>& outputs);
 
     std::vector<bool> supportedOperations();
+    // Whether every operation is supported and every operand fits nnlib,
+    // as far as can be told before unknown dimensions are known.
+    bool verifyWithUnknownDimensions();
     bool prepare();
-    bool execute(const Request& request);
+    // Fills the DSP time of timing, if given. The pools of the request are
+    // mapped for this execution only.
+    bool execute(const Request& request, const Client& client = Client{},
+                 Timing* timing = nullptr);
+    // Executes request on pools mapped by the caller, one per pool of the
+    // request, which may leave request.pools empty. Once the model has
+    // executed as many requests concurrently as it ever will, this does not
+    // allocate.
+    bool execute(const Request& request, const MappedPools& pools, const Client& client,
+                 Timing* timing = nullptr);
+
+    // lowered graph and its interface, for the compilation cache
+    const Graph& getRecipe() const { return mGraph; }
+    const std::vector<hexagon_nn_tensordef>& getInputTemplates() const { return mInputTemplates; }
+    const std::vector<hexagon_nn_tensordef>& getOutputTemplates() const {
+        return mOutputTemplates;
+    }
+
+    // Releases the state that is only needed to lower the model: operations,
+    // operands and the mapped model pools, and moves the constants of the
+    // recipe off the heap. Only execute and the debugging calls remain
+    // usable.
+    void compact();
+
+    // Points the constants of the recipe that other holds too at the copy of
+    // other. Must be called before compact.
+    void shareConstants(const Model& other);
+
+    // Tears down the graphs on the DSP if they are idle, keeping the recipe
+    // to materialize them again on the next execution.
+    void evict();
 
    private:
-    uint32_t getNextNode();
     uint32_t addOperationInternal(op_type op, hexagon_nn_padding_type pad,
                                   const std::vector<hexagon_nn_input>& inputs,
                                   const std::vector<hexagon_nn_output>& outputs);
@@ -147,29 +176,52 @@ class Model {
     bool registerHexagonInputs(const std::vector<uint32_t>& operands, uint32_t node);
 
     bool verifyOperations();
-    bool verifyOperands();
+    bool verifyOperands(bool allowUnknownDimensions = false);
+    bool isFoldable(const Operation& operation) const;
+    bool foldOperation(const Operation& operation);
+    void foldConstants();
+    bool readsSameRows(const Operation& operation, uint32_t source) const;
+    void elideReshapes();
+    void removeDeadOperations();
     bool addInputs();
     bool addOperations();
     bool addOutputs();
-
+    std::vector<hexagon_nn_tensordef> createTemplates(const std::vector<uint32_t>& operands);
+    bool bindRequest(const Request& request, const MappedPools& pools, Bindings* bindings);
+    std::shared_ptr<Bindings> acquireBindings();
+    void releaseBindings(std::shared_ptr<Bindings> bindings);
+    int executeInternal(const std::shared_ptr<Bindings>& bindings, const Client& client,
+                        Timing* timing);
+
+    bool materialize();
     void clearModel();
+    void updateHostBytes();
 
     // members
-    hexagon_nn_nn_id mGraphId;
-    uint32_t mNodeCount;
-    bool mCompiled;
-    std::vector<OperandInfo> mOperands;
+    Graph mGraph;
+    GraphPool mReplicas;
+    std::atomic<bool> mCompiled;
+    std::atomic<uint64_t> mExecuteMicros;
+    OperandTable mOperands;
     std::vector<Operation> mOperations;
+    // values of the operands computed by constant folding
+    std::vector<std::vector<uint8_t>> mFoldedValues;
     std::vector<uint32_t> mInputs;
     std::vector<uint32_t> mOutputs;
     std::vector<RunTimePoolInfo> mPools;
+
+    // tensordefs of the inputs and outputs, without their data
+    std::vector<hexagon_nn_tensordef> mInputTemplates;
+    std::vector<hexagon_nn_tensordef> mOutputTemplates;
+    std::mutex mBindingsMutex;
+    std::vector<std::shared_ptr<Bindings>> mFreeBindings;
 };
 
 // template implementations
 
 template <typename Type>
 Type Model::getScalar(uint32_t operand) {
-    return *reinterpret_cast<const Type*>(mOperands[operand].buffer);
+    return *reinterpret_cast<const Type*>(mOperands.buffer(operand));
 }
 
 template <typename Type>
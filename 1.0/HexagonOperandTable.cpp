@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "android.hardware.neuralnetworks@1.0-impl-hvx"
+
+#include "HexagonOperandTable.h"
+#include <functional>
+#include <numeric>
+#include "HexagonUtils.h"
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+
+constexpr uint32_t Dimensions::kMaxRank;
+
+std::array<uint32_t, Dimensions::kMaxRank> Dimensions::aligned() const {
+    std::array<uint32_t, kMaxRank> dims;
+    const uint32_t padding = kMaxRank - std::min(rank, kMaxRank);
+    std::fill_n(dims.begin(), padding, 1);
+    std::copy(begin(), end(), dims.begin() + padding);
+    return dims;
+}
+
+void OperandTable::assign(const ::android::hardware::neuralnetworks::V1_0::Model& model,
+                          const std::vector<RunTimePoolInfo>& pools) {
+    const size_t count = model.operands.size();
+    mTypes.resize(count);
+    mDimensions.resize(count);
+    mScales.resize(count);
+    mZeroPoints.resize(count);
+    mLifetimes.resize(count);
+    mBuffers.resize(count);
+    mLengths.resize(count);
+    mHexagon.assign(count, HexagonTensors{});
+
+    for (size_t i = 0; i < count; ++i) {
+        const Operand& operand = model.operands[i];
+        mTypes[i] = operand.type;
+        mDimensions[i] = Dimensions(operand.dimensions);
+        mScales[i] = operand.scale;
+        mZeroPoints[i] = operand.zeroPoint;
+        mLifetimes[i] = operand.lifetime;
+        mBuffers[i] = const_cast<uint8_t*>(getData(operand, model.operandValues, pools));
+        mLengths[i] = operand.location.length;
+    }
+}
+
+uint32_t OperandTable::byteSize(uint32_t operand) const {
+    const Dimensions& dims = mDimensions[operand];
+    return std::accumulate(dims.begin(), dims.end(), getSize(mTypes[operand]),
+                           std::multiplies<>{});
+}
+
+uint64_t OperandTable::getHostBytes() const {
+    return mTypes.capacity() * sizeof(OperandType) + mDimensions.capacity() * sizeof(Dimensions) +
+           mScales.capacity() * sizeof(float) + mZeroPoints.capacity() * sizeof(int32_t) +
+           mLifetimes.capacity() * sizeof(OperandLifeTime) +
+           mBuffers.capacity() * sizeof(uint8_t*) + mLengths.capacity() * sizeof(uint32_t) +
+           mHexagon.capacity() * sizeof(HexagonTensors);
+}
+
+void OperandTable::clearHexagon() {
+    std::fill(mHexagon.begin(), mHexagon.end(), HexagonTensors{});
+}
+
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
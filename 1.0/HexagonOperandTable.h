@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_V1_0_HEXAGON_OPERAND_TABLE_H
+#define ANDROID_HARDWARE_V1_0_HEXAGON_OPERAND_TABLE_H
+
+#include <android/hardware/neuralnetworks/1.0/types.h>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "CpuExecutor.h"
+#include "hexagon_nn_controller/hexagon_nn_controller.h"
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+
+using ::android::nn::RunTimePoolInfo;
+
+// Operand dimensions, stored inline. nnlib tensors have at most 4 dimensions;
+// of a larger operand only the rank is kept, and the model is rejected.
+struct Dimensions {
+    static constexpr uint32_t kMaxRank = 4;
+
+    Dimensions() : rank(0), values{} {}
+    template <typename Container>
+    explicit Dimensions(const Container& dims) : rank(dims.size()), values{} {
+        std::copy_n(dims.begin(), std::min(rank, kMaxRank), values);
+    }
+
+    const uint32_t* begin() const { return values; }
+    const uint32_t* end() const { return values + std::min(rank, kMaxRank); }
+    uint32_t size() const { return rank; }
+    std::vector<uint32_t> toVector() const { return std::vector<uint32_t>(begin(), end()); }
+
+    // padded with leading 1s to 4 dimensions
+    std::array<uint32_t, kMaxRank> aligned() const;
+
+    uint32_t rank;
+    uint32_t values[kMaxRank];
+};
+
+// nnlib tensors holding an operand, and its quantization range
+struct HexagonTensors {
+    hexagon_nn_input tensor;
+    hexagon_nn_input min;
+    hexagon_nn_input max;
+};
+
+// Runtime operand information, as a structure of arrays. Lowering walks one
+// or two properties of many operands at a time, which then stay contiguous,
+// and no operand needs a heap block of its own.
+class OperandTable {
+   public:
+    void assign(const ::android::hardware::neuralnetworks::V1_0::Model& model,
+                const std::vector<RunTimePoolInfo>& pools);
+
+    size_t size() const { return mTypes.size(); }
+
+    // tensor information
+    OperandType type(uint32_t operand) const { return mTypes[operand]; }
+    const Dimensions& dimensions(uint32_t operand) const { return mDimensions[operand]; }
+    void setDimensions(uint32_t operand, const Dimensions& dimensions) {
+        mDimensions[operand] = dimensions;
+    }
+    // size in bytes of the operand's current shape
+    uint32_t byteSize(uint32_t operand) const;
+
+    // (optional) quantization parameters
+    float scale(uint32_t operand) const { return mScales[operand]; }
+    int32_t zeroPoint(uint32_t operand) const { return mZeroPoints[operand]; }
+
+    // lifetime and data location
+    OperandLifeTime lifetime(uint32_t operand) const { return mLifetimes[operand]; }
+    uint8_t* buffer(uint32_t operand) const { return mBuffers[operand]; }
+    uint32_t length(uint32_t operand) const { return mLengths[operand]; }
+    // turns the operand into a constant held in buffer, e.g. once folded
+    void setConstant(uint32_t operand, uint8_t* buffer, uint32_t length) {
+        mLifetimes[operand] = OperandLifeTime::CONSTANT_COPY;
+        mBuffers[operand] = buffer;
+        mLengths[operand] = length;
+    }
+
+    // Hexagon nnlib identifiers
+    HexagonTensors& hexagon(uint32_t operand) { return mHexagon[operand]; }
+    void clearHexagon();
+
+    uint64_t getHostBytes() const;
+
+   private:
+    std::vector<OperandType> mTypes;
+    std::vector<Dimensions> mDimensions;
+    std::vector<float> mScales;
+    std::vector<int32_t> mZeroPoints;
+    std::vector<OperandLifeTime> mLifetimes;
+    std::vector<uint8_t*> mBuffers;
+    std::vector<uint32_t> mLengths;
+    std::vector<HexagonTensors> mHexagon;
+};
+
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_V1_0_HEXAGON_OPERAND_TABLE_H
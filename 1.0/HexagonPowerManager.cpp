@@ -0,0 +1,260 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "android.hardware.neuralnetworks@1.0-impl-hvx"
+
+#include "HexagonPowerManager.h"
+#include <android-base/logging.h>
+#include <android-base/properties.h>
+#include <algorithm>
+#include "HexagonController.h"
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+
+namespace {
+
+constexpr int kBoostBusUsage = 100;
+
+const char* kLevelNames[] = {
+    "power_save",
+    "balanced",
+    "boost",
+};
+
+// nominal DSP clock of each level, overridden per device by
+// vendor.hvx.power.clock_mhz.<level>
+const uint32_t kDefaultClockMhz[] = {
+    404,
+    729,
+    960,
+};
+
+const char* kWorkloadNames[] = {
+    "interactive",
+    "normal",
+    "background",
+};
+
+// persist.vendor.hvx.power.pin.<workload> may hold the name of a power level
+bool getPinnedLevel(WorkloadClass workload, PowerLevel* level) {
+    const std::string value = ::android::base::GetProperty(
+        std::string("persist.vendor.hvx.power.pin.") + toString(workload), "");
+    for (size_t i = 0; i < kNumPowerLevels; ++i) {
+        if (value == kLevelNames[i]) {
+            *level = static_cast<PowerLevel>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+}  // anonymous namespace
+
+std::string toString(PowerLevel level) {
+    return static_cast<size_t>(level) < kNumPowerLevels ? kLevelNames[static_cast<size_t>(level)]
+                                                         : "<invalid PowerLevel>";
+}
+
+std::string toString(WorkloadClass workload) {
+    return static_cast<size_t>(workload) < kNumWorkloadClasses
+               ? kWorkloadNames[static_cast<size_t>(workload)]
+               : "<invalid WorkloadClass>";
+}
+
+PowerManager::PowerManager()
+    : mIdleTimeout(::android::base::GetUintProperty<uint32_t>(
+          "vendor.hvx.power.idle_timeout_ms", 1000)),
+      mBoostQueueDepth(
+          ::android::base::GetUintProperty<uint32_t>("vendor.hvx.power.boost_queue_depth", 2)),
+      mPowerSaveLevel(
+          ::android::base::GetUintProperty<uint32_t>("vendor.hvx.power.powersave_level", 1)),
+      mStopping(false),
+      mLevel(PowerLevel::BOOST),
+      mAppliedLevel(PowerLevel::BOOST),
+      mActive(0),
+      mLastActivity(Clock::now()),
+      mLevelSince(Clock::now()),
+      mTimeInLevel{},
+      mPinned{},
+      mPins{},
+      mClockMhz{} {
+    for (size_t i = 0; i < kNumWorkloadClasses; ++i) {
+        mPinned[i] = getPinnedLevel(static_cast<WorkloadClass>(i), &mPins[i]);
+    }
+    for (size_t i = 0; i < kNumPowerLevels; ++i) {
+        const std::string property = std::string("vendor.hvx.power.clock_mhz.") + kLevelNames[i];
+        mClockMhz[i] = std::max<uint32_t>(
+            1, ::android::base::GetUintProperty<uint32_t>(property, kDefaultClockMhz[i]));
+    }
+    if (::android::base::GetBoolProperty("vendor.hvx.power.disable_dcvs", false)) {
+        Controller::getInstance().disable_dcvs();
+    }
+    mIdleThread = std::thread([this]() { idleLoop(); });
+}
+
+PowerManager::~PowerManager() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mIdle.notify_all();
+    mIdleThread.join();
+}
+
+PowerManager& PowerManager::getInstance() {
+    static PowerManager instance{};
+    return instance;
+}
+
+PowerManager::Vote::Vote(WorkloadClass workload) {
+    PowerManager::getInstance().begin(workload);
+}
+
+PowerManager::Vote::~Vote() {
+    PowerManager::getInstance().end();
+}
+
+void PowerManager::begin(WorkloadClass workload) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    ++mActive;
+    mLastActivity = Clock::now();
+
+    // pinned classes get exactly their level, everything else is boosted when
+    // latency matters or requests start to queue up
+    const size_t index = static_cast<size_t>(workload);
+    PowerLevel target;
+    if (mPinned[index]) {
+        target = mPins[index];
+    } else if (workload == WorkloadClass::INTERACTIVE || mActive >= mBoostQueueDepth) {
+        target = PowerLevel::BOOST;
+    } else {
+        target = PowerLevel::BALANCED;
+    }
+
+    // never lower the clocks underneath work that is already in flight
+    if ((target > mLevel || (mActive == 1 && mPinned[index])) && setLevelLocked(target)) {
+        lock.unlock();
+        applyLevel(false);
+    }
+}
+
+void PowerManager::end() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        --mActive;
+        mLastActivity = Clock::now();
+    }
+    mIdle.notify_all();
+}
+
+bool PowerManager::setLevelLocked(PowerLevel level) {
+    if (level == mLevel) {
+        return false;
+    }
+    const Clock::time_point now = Clock::now();
+    mTimeInLevel[static_cast<size_t>(mLevel)] += now - mLevelSince;
+    mLevelSince = now;
+    mLevel = level;
+    return true;
+}
+
+// The DSP calls are made without mMutex, so that votes which do not change the
+// level never wait for them. mApplyMutex orders them, and whoever applies
+// last pushes the latest level.
+void PowerManager::applyLevel(bool force) {
+    std::lock_guard<std::mutex> applyLock(mApplyMutex);
+    PowerLevel level;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        level = mLevel;
+    }
+    if (level == mAppliedLevel && !force) {
+        return;
+    }
+
+    if (mAppliedLevel == PowerLevel::POWER_SAVE && level != PowerLevel::POWER_SAVE) {
+        Controller::getInstance().set_powersave_level(0);
+    }
+    switch (level) {
+        case PowerLevel::BOOST:
+            Controller::getInstance().boost(kBoostBusUsage);
+            break;
+        case PowerLevel::BALANCED:
+            Controller::getInstance().slow();
+            break;
+        case PowerLevel::POWER_SAVE:
+            Controller::getInstance().slow();
+            Controller::getInstance().set_powersave_level(mPowerSaveLevel);
+            break;
+    }
+    mAppliedLevel = level;
+}
+
+void PowerManager::apply() {
+    applyLevel(true);
+}
+
+void PowerManager::idleLoop() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (!mStopping) {
+        if (mActive > 0 || mLevel == PowerLevel::POWER_SAVE) {
+            mIdle.wait(lock);
+            continue;
+        }
+        // clocks step down one level per idle timeout
+        const Clock::time_point deadline = std::max(mLastActivity, mLevelSince) + mIdleTimeout;
+        if (Clock::now() < deadline) {
+            mIdle.wait_until(lock, deadline);
+            continue;
+        }
+        setLevelLocked(static_cast<PowerLevel>(static_cast<uint32_t>(mLevel) - 1));
+        lock.unlock();
+        applyLevel(false);
+        lock.lock();
+    }
+}
+
+uint32_t PowerManager::getClockMhz() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mClockMhz[static_cast<size_t>(mLevel)];
+}
+
+std::string PowerManager::dump() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    std::array<Clock::duration, kNumPowerLevels> timeInLevel = mTimeInLevel;
+    timeInLevel[static_cast<size_t>(mLevel)] += Clock::now() - mLevelSince;
+
+    std::string os = "power level: " + toString(mLevel) + "\n";
+    for (size_t i = 0; i < kNumPowerLevels; ++i) {
+        os += "  time in " + toString(static_cast<PowerLevel>(i)) + ": " +
+              std::to_string(
+                  std::chrono::duration_cast<std::chrono::milliseconds>(timeInLevel[i]).count()) +
+              " ms\n";
+    }
+    return os;
+}
+
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
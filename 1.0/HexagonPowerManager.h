@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_V1_0_HEXAGON_POWER_MANAGER_H
+#define ANDROID_HARDWARE_V1_0_HEXAGON_POWER_MANAGER_H
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+
+enum class PowerLevel : uint32_t {
+    POWER_SAVE,
+    BALANCED,
+    BOOST,
+};
+constexpr size_t kNumPowerLevels = 3;
+
+enum class WorkloadClass : uint32_t {
+    INTERACTIVE,
+    NORMAL,
+    BACKGROUND,
+};
+constexpr size_t kNumWorkloadClasses = 3;
+
+std::string toString(PowerLevel level);
+std::string toString(WorkloadClass workload);
+
+// Adapts the DSP clocks to the execution traffic. Clocks are raised while
+// work is in flight, and stepped down one level each time the DSP has been
+// idle for a configurable timeout, until the power-save level.
+class PowerManager {
+    // methods
+   private:
+    PowerManager();
+    ~PowerManager();
+    PowerManager(const PowerManager&) = delete;
+    PowerManager(PowerManager&&) = delete;
+    PowerManager& operator=(const PowerManager&) = delete;
+    PowerManager& operator=(PowerManager&&) = delete;
+
+    void begin(WorkloadClass workload);
+    void end();
+    // returns true if the level changed, and must then be applied
+    bool setLevelLocked(PowerLevel level);
+    void applyLevel(bool force);
+    void idleLoop();
+
+   public:
+    static PowerManager& getInstance();
+
+    // Held for the duration of every call into the DSP.
+    class Vote {
+       public:
+        Vote(WorkloadClass workload = WorkloadClass::NORMAL);
+        ~Vote();
+        Vote(const Vote&) = delete;
+        Vote& operator=(const Vote&) = delete;
+    };
+
+    // Pushes the current level to nnlib, e.g. after it has been (re)loaded.
+    void apply();
+
+    // Nominal DSP clock of the current level. Executions read it when they
+    // start, to convert their cycles to time at the clock they ran at.
+    uint32_t getClockMhz();
+
+    std::string dump();
+
+    // members
+   private:
+    using Clock = std::chrono::steady_clock;
+
+    const std::chrono::milliseconds mIdleTimeout;
+    const uint32_t mBoostQueueDepth;
+    const uint32_t mPowerSaveLevel;
+
+    std::mutex mMutex;
+    std::mutex mApplyMutex;
+    std::condition_variable mIdle;
+    std::thread mIdleThread;
+    bool mStopping;
+
+    PowerLevel mLevel;
+    PowerLevel mAppliedLevel;  // guarded by mApplyMutex
+    uint32_t mActive;
+    Clock::time_point mLastActivity;
+    Clock::time_point mLevelSince;
+    std::array<Clock::duration, kNumPowerLevels> mTimeInLevel;
+    std::array<bool, kNumWorkloadClasses> mPinned;
+    std::array<PowerLevel, kNumWorkloadClasses> mPins;
+    std::array<uint32_t, kNumPowerLevels> mClockMhz;
+};
+
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_V1_0_HEXAGON_POWER_MANAGER_H
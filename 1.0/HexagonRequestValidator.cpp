@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "android.hardware.neuralnetworks@1.0-impl-hvx"
+
+#include "HexagonRequestValidator.h"
+#include "HexagonUtils.h"
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+
+namespace {
+
+// getPoolSize returns the size of a pool, given its index below poolCount
+template <typename GetPoolSize>
+bool validateArguments(const hidl_vec<RequestArgument>& arguments,
+                       const std::vector<Dimensions>& operands, size_t poolCount,
+                       GetPoolSize getPoolSize, const char* type) {
+    HEXAGON_SOFT_ASSERT_EQ(operands.size(), arguments.size(),
+                           "Request specifies " << arguments.size() << " " << type << "s");
+    for (size_t i = 0; i < arguments.size(); ++i) {
+        const RequestArgument& argument = arguments[i];
+        const DataLocation& location = argument.location;
+        if (argument.hasNoValue) {
+            HEXAGON_SOFT_ASSERT(location.poolIndex == 0 && location.offset == 0 &&
+                                    location.length == 0 && argument.dimensions.size() == 0,
+                                "Request " << type << " " << i << " has no value but a location");
+            continue;
+        }
+
+        HEXAGON_SOFT_ASSERT_LT(location.poolIndex, poolCount,
+                               "Request " << type << " " << i << " has an invalid pool");
+        HEXAGON_SOFT_ASSERT_LE(static_cast<uint64_t>(location.offset) + location.length,
+                               getPoolSize(location.poolIndex),
+                               "Request " << type << " " << i << " is out of its pool");
+
+        // dimensions may only specify what the model leaves unknown
+        if (argument.dimensions.size() > 0) {
+            const Dimensions& declared = operands[i];
+            if (declared.size() > 0) {
+                HEXAGON_SOFT_ASSERT_EQ(declared.size(), argument.dimensions.size(),
+                                       "Request " << type << " " << i << " has a different rank");
+            }
+            const uint32_t* dim = declared.begin();
+            for (size_t d = 0; d < argument.dimensions.size() && dim != declared.end();
+                 ++d, ++dim) {
+                HEXAGON_SOFT_ASSERT(*dim == 0 || *dim == argument.dimensions[d],
+                                    "Request " << type << " " << i << " has a different shape");
+            }
+        }
+    }
+    return true;
+}
+
+bool isSupported(const hidl_memory& pool) {
+    HEXAGON_SOFT_ASSERT(pool.name() == "ashmem" || pool.name() == "mmap_fd",
+                        "Unsupported memory type " << std::string(pool.name()));
+    return true;
+}
+
+}  // anonymous namespace
+
+RequestValidator::RequestValidator(const ::android::hardware::neuralnetworks::V1_0::Model& model) {
+    for (uint32_t index : model.inputIndexes) {
+        mInputs.emplace_back(model.operands[index].dimensions);
+    }
+    for (uint32_t index : model.outputIndexes) {
+        mOutputs.emplace_back(model.operands[index].dimensions);
+    }
+}
+
+RequestValidator::RequestValidator(std::vector<Dimensions> inputs, std::vector<Dimensions> outputs)
+    : mInputs(std::move(inputs)), mOutputs(std::move(outputs)) {}
+
+bool RequestValidator::validate(const Request& request) const {
+    for (const hidl_memory& pool : request.pools) {
+        HEXAGON_SOFT_ASSERT(isSupported(pool), "Unsupported pool");
+    }
+    auto getPoolSize = [&request](uint32_t index) { return request.pools[index].size(); };
+    return validateArguments(request.inputs, mInputs, request.pools.size(), getPoolSize,
+                             "input") &&
+           validateArguments(request.outputs, mOutputs, request.pools.size(), getPoolSize,
+                             "output");
+}
+
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
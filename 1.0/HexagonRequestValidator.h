@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_V1_0_HEXAGON_REQUEST_VALIDATOR_H
+#define ANDROID_HARDWARE_V1_0_HEXAGON_REQUEST_VALIDATOR_H
+
+#include <android/hardware/neuralnetworks/1.0/types.h>
+#include <vector>
+#include "HexagonOperandTable.h"
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+
+// Validates requests against the shapes of the model's inputs and outputs,
+// without holding on to the rest of the model.
+class RequestValidator {
+   public:
+    explicit RequestValidator(const ::android::hardware::neuralnetworks::V1_0::Model& model);
+    RequestValidator(std::vector<Dimensions> inputs, std::vector<Dimensions> outputs);
+
+    bool validate(const Request& request) const;
+
+    const std::vector<Dimensions>& getInputs() const { return mInputs; }
+    const std::vector<Dimensions>& getOutputs() const { return mOutputs; }
+
+   private:
+    std::vector<Dimensions> mInputs;
+    std::vector<Dimensions> mOutputs;
+};
+
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_V1_0_HEXAGON_REQUEST_VALIDATOR_H
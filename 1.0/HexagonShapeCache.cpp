@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "android.hardware.neuralnetworks@1.0-impl-hvx"
+
+#include "HexagonShapeCache.h"
+#include <android-base/logging.h>
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include "HexagonDispatcher.h"
+#include "HexagonMemoryBudget.h"
+#include "HexagonUtils.h"
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+
+namespace {
+
+bool isTensor(OperandType type) {
+    return type == OperandType::TENSOR_FLOAT32 || type == OperandType::TENSOR_INT32 ||
+           type == OperandType::TENSOR_QUANT8_ASYMM;
+}
+
+bool isKnown(OperandType type, const std::vector<uint32_t>& dimensions) {
+    if (isTensor(type) && dimensions.empty()) {
+        return false;
+    }
+    return std::none_of(dimensions.begin(), dimensions.end(), [](uint32_t d) { return d == 0; });
+}
+
+}  // anonymous namespace
+
+ShapeCache::ShapeCache(const NeuralnetworksModel& model, size_t capacity)
+    : mModel(model), mCapacity(std::max<size_t>(1, capacity)) {
+    // the model is kept to be lowered again
+    uint64_t bytes = mModel.operandValues.size();
+    for (const hidl_memory& pool : mModel.pools) {
+        bytes += pool.size();
+    }
+    MemoryBudget::getInstance().setHostBytes(this, bytes);
+}
+
+ShapeCache::~ShapeCache() {
+    MemoryBudget::getInstance().forget(this);
+}
+
+bool ShapeCache::hasDynamicInputs(const NeuralnetworksModel& model) {
+    return std::any_of(model.inputIndexes.begin(), model.inputIndexes.end(),
+                       [&model](uint32_t index) {
+                           const Operand& operand = model.operands[index];
+                           return !isKnown(operand.type, operand.dimensions);
+                       });
+}
+
+std::shared_ptr<Model> ShapeCache::get(const Request& request) {
+    Signature signature;
+    for (size_t i = 0; i < request.inputs.size(); ++i) {
+        const Operand& operand = mModel.operands[mModel.inputIndexes[i]];
+        const hidl_vec<uint32_t>& dimensions = request.inputs[i].dimensions.size() > 0
+                                                   ? request.inputs[i].dimensions
+                                                   : operand.dimensions;
+        signature.push_back(dimensions);
+        HEXAGON_SOFT_ASSERT(isKnown(operand.type, signature.back()),
+                            "Request does not specify the shape of input " << i);
+    }
+
+    std::shared_future<std::shared_ptr<Model>> future;
+    // Destroying the graph of an evicted entry tears it down on the DSP, so
+    // it happens after the lock is released.
+    std::list<Entry> evicted;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto it = std::find_if(mEntries.begin(), mEntries.end(), [&signature](const Entry& entry) {
+            return entry.first == signature;
+        });
+        if (it != mEntries.end()) {
+            mEntries.splice(mEntries.begin(), mEntries, it);
+        } else {
+            // built on a prepare worker, so that requests for other shapes
+            // keep running meanwhile
+            auto promise = std::make_shared<std::promise<std::shared_ptr<Model>>>();
+            mEntries.emplace_front(signature, promise->get_future().share());
+            Dispatcher::getInstance().post([self = shared_from_this(), signature, promise]() {
+                promise->set_value(self->build(signature));
+            });
+            if (mEntries.size() > mCapacity) {
+                evicted.splice(evicted.begin(), mEntries, std::prev(mEntries.end()));
+            }
+        }
+        future = mEntries.front().second;
+    }
+
+    std::shared_ptr<Model> model = future.get();
+    if (model == nullptr) {
+        // let a later request try again
+        forget(signature);
+    }
+    return model;
+}
+
+std::shared_ptr<Model> ShapeCache::build(const Signature& signature) {
+    const auto start = std::chrono::steady_clock::now();
+
+    NeuralnetworksModel specialized = mModel;
+    for (size_t i = 0; i < signature.size(); ++i) {
+        specialized.operands[specialized.inputIndexes[i]].dimensions = signature[i];
+    }
+
+    // the operation checks propagate the input shapes through the model
+    std::shared_ptr<Model> model = std::make_shared<Model>(specialized);
+    if (!model->prepare()) {
+        LOG(ERROR) << "Failed to specialize the model for new input shapes";
+        return nullptr;
+    }
+    model->compact();
+
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    LOG(INFO) << "Specialized the model for new input shapes in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() << " ms";
+    return model;
+}
+
+void ShapeCache::forget(const Signature& signature) {
+    std::list<Entry> forgotten;
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto it = mEntries.begin(); it != mEntries.end();) {
+        auto next = std::next(it);
+        if (it->first == signature) {
+            forgotten.splice(forgotten.begin(), mEntries, it);
+        }
+        it = next;
+    }
+}
+
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
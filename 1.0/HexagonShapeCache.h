@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_V1_0_HEXAGON_SHAPE_CACHE_H
+#define ANDROID_HARDWARE_V1_0_HEXAGON_SHAPE_CACHE_H
+
+#include <android/hardware/neuralnetworks/1.0/types.h>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "HexagonModel.h"
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+
+// Graphs specialized for the input shapes of requests. nnlib graphs have
+// static shapes, so a model whose inputs have unknown dimensions is lowered
+// once per input-shape signature, when the first request with that signature
+// arrives, on a prepare worker of the Dispatcher. The most recently used
+// graphs are kept. Must be owned by a std::shared_ptr, which builds in flight
+// hold on to.
+class ShapeCache : public std::enable_shared_from_this<ShapeCache> {
+    // methods
+   public:
+    ShapeCache(const NeuralnetworksModel& model, size_t capacity);
+    ~ShapeCache();
+    ShapeCache(const ShapeCache&) = delete;
+    ShapeCache& operator=(const ShapeCache&) = delete;
+
+    // whether the model has inputs of unknown shape
+    static bool hasDynamicInputs(const NeuralnetworksModel& model);
+
+    // Returns the graph for the input shapes of the request, waiting for it
+    // to be built if needed. Returns nullptr on error.
+    std::shared_ptr<Model> get(const Request& request);
+
+   private:
+    using Signature = std::vector<std::vector<uint32_t>>;
+    using Entry = std::pair<Signature, std::shared_future<std::shared_ptr<Model>>>;
+
+    std::shared_ptr<Model> build(const Signature& signature);
+    void forget(const Signature& signature);
+
+    // members
+   private:
+    const NeuralnetworksModel mModel;
+    const size_t mCapacity;
+
+    std::mutex mMutex;
+    std::list<Entry> mEntries;  // most recently used first
+};
+
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_V1_0_HEXAGON_SHAPE_CACHE_H
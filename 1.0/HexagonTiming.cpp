@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define LOG_TAG "android.hardware.neuralnetworks@1.0-impl-hvx"
+
+#include "HexagonTiming.h"
+#include <algorithm>
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+
+constexpr uint64_t Timing::kNoTiming;
+constexpr size_t TimingReport::kHistorySize;
+
+namespace {
+
+std::string toString(uint64_t micros) {
+    return micros == Timing::kNoTiming ? "n/a" : std::to_string(micros) + " us";
+}
+
+// average and max of the known durations
+std::string summarize(const Timing* begin, const Timing* end, uint64_t Timing::*duration) {
+    uint64_t total = 0;
+    uint64_t max = 0;
+    uint64_t count = 0;
+    for (const Timing* timing = begin; timing != end; ++timing) {
+        const uint64_t value = timing->*duration;
+        if (value != Timing::kNoTiming) {
+            total += value;
+            max = std::max(max, value);
+            ++count;
+        }
+    }
+    return count == 0 ? "n/a" : toString(total / count) + " average, " + toString(max) + " max";
+}
+
+}  // anonymous namespace
+
+TimingReport::TimingReport() : mHistory{}, mRecorded(0) {}
+
+TimingReport& TimingReport::getInstance() {
+    static TimingReport instance{};
+    return instance;
+}
+
+void TimingReport::record(const Timing& timing) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mHistory[mRecorded++ % kHistorySize] = timing;
+}
+
+std::string TimingReport::dump(bool verbose) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    const size_t count = std::min<uint64_t>(mRecorded, kHistorySize);
+    std::string os = "execution timing (last " + std::to_string(count) + " of " +
+                     std::to_string(mRecorded) + " executions):\n  on device: " +
+                     summarize(mHistory.data(), mHistory.data() + count, &Timing::timeOnDevice) +
+                     "\n  in driver: " +
+                     summarize(mHistory.data(), mHistory.data() + count, &Timing::timeInDriver) +
+                     "\n";
+    if (verbose) {
+        // oldest first
+        for (uint64_t i = mRecorded - count; i < mRecorded; ++i) {
+            const Timing& timing = mHistory[i % kHistorySize];
+            os += "  #" + std::to_string(i) + " (pid " + std::to_string(timing.pid) +
+                  "): device " + toString(timing.timeOnDevice) +
+                  (timing.clockMhz != 0 ? " at " + std::to_string(timing.clockMhz) + " MHz" : "") +
+                  ", driver " + toString(timing.timeInDriver) + "\n";
+        }
+    }
+    return os;
+}
+
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef ANDROID_HARDWARE_V1_0_HEXAGON_TIMING_H
+#define ANDROID_HARDWARE_V1_0_HEXAGON_TIMING_H
+
+#include <sys/types.h>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <string>
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+
+// Measured duration of one execution, in microseconds, or kNoTiming where
+// it is not known, and what it was measured for.
+struct Timing {
+    static constexpr uint64_t kNoTiming = std::numeric_limits<uint64_t>::max();
+
+    // on the DSP, from its cycle counter
+    uint64_t timeOnDevice = kNoTiming;
+    // from receiving the request to reporting its result
+    uint64_t timeInDriver = kNoTiming;
+    // DSP clock the cycles were converted at: that of the power level the
+    // execution started at, or 0 if unknown
+    uint32_t clockMhz = 0;
+    // client that made the request
+    pid_t pid = 0;
+};
+
+// Timing of the most recent executions, for clients and benchmarking tools.
+// It is reported by IDevice::debug, and listed per execution, with the
+// client and clock of each, with the
+// "--timing" option (lshal debug android.hardware.neuralnetworks@1.0::IDevice/hvx --timing).
+class TimingReport {
+    // methods
+   private:
+    TimingReport();
+    ~TimingReport() = default;
+    TimingReport(const TimingReport&) = delete;
+    TimingReport(TimingReport&&) = delete;
+    TimingReport& operator=(const TimingReport&) = delete;
+    TimingReport& operator=(TimingReport&&) = delete;
+
+   public:
+    static TimingReport& getInstance();
+
+    void record(const Timing& timing);
+
+    std::string dump(bool verbose);
+
+    // members
+   private:
+    static constexpr size_t kHistorySize = 64;
+
+    std::mutex mMutex;
+    std::array<Timing, kHistorySize> mHistory;
+    uint64_t mRecorded;
+};
+
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_V1_0_HEXAGON_TIMING_H
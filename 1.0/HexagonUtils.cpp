@@ -17,7 +17,10 @@
 #define LOG_TAG "android.hardware.neuralnetworks@1.0-impl-hvx"
 
 #include "HexagonUtils.h"
+#include <android/hidl/allocator/1.0/IAllocator.h>
 #include <hidlmemory/mapping.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include <algorithm>
 #include <numeric>
 #include <vector>
@@ -31,12 +34,16 @@ namespace implementation {
 namespace hexagon {
 
 bool isHexagonAvailable() {
+    // a call that a reset gave up on still holds the DSP
     int version = -1;
-    Controller::getInstance().version(&version);
+    if (!Controller::getInstance().isHung()) {
+        Controller::getInstance().version(&version);
+    }
     if (version != 92) {
         LOG(INFO) << "ATTEMPTING TO RESTART NNLIB";
-        Controller::getInstance().resetNnlib();
-        Controller::getInstance().version(&version);
+        if (Controller::getInstance().resetNnlib()) {
+            Controller::getInstance().version(&version);
+        }
     }
     return version == 92;
 }
@@ -123,12 +130,122 @@ std::vector<RunTimePoolInfo> mapPools(const hidl_vec<hidl_memory>& pools) {
     return poolInfos;
 }
 
-std::unordered_set<uint32_t> getPoolIndexes(const std::vector<RequestArgument>& inputsOutputs) {
-    std::unordered_set<uint32_t> indexes;
-    for (const RequestArgument& inputOutput : inputsOutputs) {
-        indexes.insert(inputOutput.location.poolIndex);
+MappedPool mapPool(const hidl_memory& pool) {
+    MappedPool mapped = std::make_shared<RunTimePoolInfo>();
+    HEXAGON_SOFT_ASSERT(mapped->set(pool), "Error setting pool");
+    return mapped;
+}
+
+bool mapPools(const hidl_vec<hidl_memory>& pools, MappedPools* mapped) {
+    mapped->resize(pools.size());
+    for (size_t i = 0; i < pools.size(); i++) {
+        (*mapped)[i] = mapPool(pools[i]);
+        HEXAGON_SOFT_ASSERT((*mapped)[i] != nullptr, "Error mapping pool " << i);
     }
-    return indexes;
+    return true;
+}
+
+static bool syncRange(const RunTimePoolInfo& pool, const DataLocation& location) {
+    static const uintptr_t kPageMask = ~(static_cast<uintptr_t>(getpagesize()) - 1);
+    const uintptr_t begin = reinterpret_cast<uintptr_t>(pool.buffer + location.offset);
+    const uintptr_t end = begin + location.length;
+    return msync(reinterpret_cast<void*>(begin & kPageMask), end - (begin & kPageMask),
+                 MS_SYNC) == 0;
+}
+
+template <typename GetPool>
+static void syncOutputsInternal(const hidl_vec<RequestArgument>& outputs, GetPool getPool) {
+    // the DSP only writes to output pools; input pools need no update
+    for (size_t i = 0; i < outputs.size(); ++i) {
+        // each pool is synchronized once, at its first output; outputs are
+        // few, so scanning them beats building a set
+        const uint32_t index = outputs[i].location.poolIndex;
+        auto samePool = [index](const RequestArgument& output) {
+            return !output.hasNoValue && output.location.poolIndex == index;
+        };
+        if (outputs[i].hasNoValue ||
+            std::any_of(outputs.begin(), outputs.begin() + i, samePool)) {
+            continue;
+        }
+        RunTimePoolInfo& pool = getPool(index);
+
+        // file-backed pools only need the pages holding the outputs flushed
+        if (pool.hidlMemory.name() != "mmap_fd") {
+            pool.update();
+            continue;
+        }
+        if ((pool.hidlMemory.handle()->data[1] & PROT_WRITE) == 0) {
+            continue;
+        }
+        for (size_t j = i; j < outputs.size(); ++j) {
+            if (samePool(outputs[j]) && !syncRange(pool, outputs[j].location)) {
+                LOG(ERROR) << "Error synchronizing output in pool " << index;
+            }
+        }
+    }
+}
+
+void syncOutputs(const hidl_vec<RequestArgument>& outputs, std::vector<RunTimePoolInfo>* pools) {
+    syncOutputsInternal(outputs, [pools](uint32_t index) -> RunTimePoolInfo& {
+        return (*pools)[index];
+    });
+}
+
+void syncOutputs(const hidl_vec<RequestArgument>& outputs, const MappedPools& pools) {
+    syncOutputsInternal(outputs, [&pools](uint32_t index) -> RunTimePoolInfo& {
+        return *pools[index];
+    });
+}
+
+hidl_memory allocateSharedMemory(int64_t size) {
+    hidl_memory memory;
+
+    sp<::android::hidl::allocator::V1_0::IAllocator> allocator =
+        ::android::hidl::allocator::V1_0::IAllocator::getService("ashmem");
+    HEXAGON_SOFT_ASSERT(allocator != nullptr, "Error getting ashmem allocator");
+
+    allocator->allocate(size, [&](bool success, const hidl_memory& mem) {
+        if (success) {
+            memory = mem;
+        }
+    });
+    HEXAGON_SOFT_ASSERT_EQ(static_cast<uint64_t>(size), memory.size(),
+                           "Error allocating " << size << " bytes of shared memory");
+
+    return memory;
+}
+
+uint32_t getSize(const Operand& operand) {
+    return std::accumulate(operand.dimensions.begin(), operand.dimensions.end(),
+                           getSize(operand.type), std::multiplies<>{});
+}
+
+bool createScratchRequest(const ::android::hardware::neuralnetworks::V1_0::Model& model,
+                          Request* request) {
+    // lay out every input and output back to back in a single pool
+    uint32_t offset = 0;
+    auto makeArguments = [&model, &offset](const hidl_vec<uint32_t>& indexes) {
+        std::vector<RequestArgument> arguments(indexes.size());
+        for (size_t i = 0; i < indexes.size(); ++i) {
+            const uint32_t length = getSize(model.operands[indexes[i]]);
+            arguments[i] = {
+                .hasNoValue = false,
+                .location = {.poolIndex = 0, .offset = offset, .length = length},
+                .dimensions = {},
+            };
+            offset += (length + 7) & ~7u;
+        }
+        return arguments;
+    };
+
+    request->inputs = makeArguments(model.inputIndexes);
+    request->outputs = makeArguments(model.outputIndexes);
+
+    hidl_memory pool = allocateSharedMemory(std::max(offset, 1u));
+    HEXAGON_SOFT_ASSERT_NE(0ul, pool.size(), "Error allocating scratch request pool");
+    request->pools = std::vector<hidl_memory>{pool};
+
+    return true;
 }
 
 namespace {
@@ -19,8 +19,8 @@
 
 #include <android-base/logging.h>
 #include <android/hardware/neuralnetworks/1.0/types.h>
+#include <memory>
 #include <string>
-#include <unordered_set>
 #include <vector>
 #include "CpuExecutor.h"
 #include "HexagonController.h"
@@ -73,7 +73,22 @@ std::vector<uint32_t> getAlignedDimensions(const std::vector<uint32_t>& dims, ui
 
 std::vector<RunTimePoolInfo> mapPools(const hidl_vec<hidl_memory>& pools);
 
-std::unordered_set<uint32_t> getPoolIndexes(const std::vector<RequestArgument>& inputsOutputs);
+// A mapping of one pool, shared by everything that uses it, so that callers
+// keeping their memories across executions map them only once.
+using MappedPool = std::shared_ptr<RunTimePoolInfo>;
+using MappedPools = std::vector<MappedPool>;
+MappedPool mapPool(const hidl_memory& pool);
+bool mapPools(const hidl_vec<hidl_memory>& pools, MappedPools* mapped);
+
+// Flushes the output pools written by the DSP. Does not allocate.
+void syncOutputs(const hidl_vec<RequestArgument>& outputs, std::vector<RunTimePoolInfo>* pools);
+void syncOutputs(const hidl_vec<RequestArgument>& outputs, const MappedPools& pools);
+
+hidl_memory allocateSharedMemory(int64_t size);
+
+uint32_t getSize(const Operand& operand);
+bool createScratchRequest(const ::android::hardware::neuralnetworks::V1_0::Model& model,
+                          Request* request);
 
 const uint8_t* getData(const Operand& operand, const hidl_vec<uint8_t>& block,
                        const std::vector<RunTimePoolInfo>& pools);
@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "android.hardware.neuralnetworks@1.0-impl-hvx"
+
+#include "HexagonWatchdog.h"
+#include <android-base/logging.h>
+#include <android-base/properties.h>
+#include <algorithm>
+#include "HexagonController.h"
+#include "HexagonPowerManager.h"
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+
+constexpr int Watchdog::kTimedOut;
+constexpr int Watchdog::kHung;
+
+struct Watchdog::Worker {
+    enum class State { IDLE, RUNNING, DONE, ABANDONED };
+
+    std::thread thread;
+    std::condition_variable started;
+    std::condition_variable finished;
+    std::function<int()> call;
+    State state = State::IDLE;
+    int result = 0;
+};
+
+Watchdog::Watchdog()
+    : mPrepareDeadline(::android::base::GetUintProperty<uint32_t>(
+          "vendor.hvx.watchdog.prepare_timeout_ms", 10000)),
+      mExecuteDeadline(::android::base::GetUintProperty<uint32_t>(
+          "vendor.hvx.watchdog.execute_timeout_ms", 2000)),
+      mStopping(false),
+      mTimeouts(0),
+      mResets(0),
+      mFailedResets(0),
+      mRebuilds(0),
+      mRecovered(0),
+      mFailed(0) {
+    const uint32_t workers = std::max<uint32_t>(
+        1, ::android::base::GetUintProperty<uint32_t>("vendor.hvx.watchdog.workers", 8));
+    for (uint32_t i = 0; i < workers; ++i) {
+        mWorkers.push_back(std::make_unique<Worker>());
+    }
+}
+
+Watchdog::~Watchdog() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    for (const std::unique_ptr<Worker>& worker : mWorkers) {
+        worker->started.notify_all();
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+}
+
+Watchdog& Watchdog::getInstance() {
+    static Watchdog instance{};
+    return instance;
+}
+
+void Watchdog::workerLoop(Worker* worker) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (true) {
+        worker->started.wait(lock, [this, worker]() {
+            return mStopping || worker->state == Worker::State::RUNNING;
+        });
+        if (worker->state != Worker::State::RUNNING) {
+            return;
+        }
+        lock.unlock();
+
+        // only this worker touches the call while it runs
+        const int result = worker->call();
+        worker->call = nullptr;
+
+        lock.lock();
+        if (worker->state == Worker::State::ABANDONED) {
+            worker->state = Worker::State::IDLE;
+            mWorkerFree.notify_one();
+        } else {
+            worker->result = result;
+            worker->state = Worker::State::DONE;
+            worker->finished.notify_one();
+        }
+    }
+}
+
+Watchdog::Worker* Watchdog::findIdleLocked() {
+    for (const std::unique_ptr<Worker>& worker : mWorkers) {
+        if (worker->state == Worker::State::IDLE) {
+            return worker.get();
+        }
+    }
+    return nullptr;
+}
+
+int Watchdog::supervise(const char* name, std::chrono::milliseconds deadline,
+                        std::function<int()> call) {
+    const auto expiry = std::chrono::steady_clock::now() + deadline;
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    // A worker running a call frees up by its own deadline at the latest,
+    // so only workers that are all stuck in abandoned calls time this out.
+    Worker* worker = nullptr;
+    while ((worker = findIdleLocked()) == nullptr) {
+        const bool running = std::any_of(
+            mWorkers.begin(), mWorkers.end(), [](const std::unique_ptr<Worker>& other) {
+                return other->state == Worker::State::RUNNING ||
+                       other->state == Worker::State::DONE;
+            });
+        if (running) {
+            mWorkerFree.wait(lock);
+        } else if (mWorkerFree.wait_until(lock, expiry) == std::cv_status::timeout &&
+                   findIdleLocked() == nullptr) {
+            lock.unlock();
+            LOG(ERROR) << "No watchdog worker is free for " << name;
+            return onTimeout(name, deadline);
+        }
+    }
+    if (!worker->thread.joinable()) {
+        worker->thread = std::thread([this, worker]() { workerLoop(worker); });
+    }
+    worker->call = std::move(call);
+    worker->state = Worker::State::RUNNING;
+    worker->started.notify_one();
+
+    if (worker->finished.wait_until(
+            lock, expiry, [worker]() { return worker->state == Worker::State::DONE; })) {
+        worker->state = Worker::State::IDLE;
+        const int result = worker->result;
+        lock.unlock();
+        mWorkerFree.notify_one();
+        return result;
+    }
+    worker->state = Worker::State::ABANDONED;
+    lock.unlock();
+    // callers waiting for this worker now wait for their own deadline
+    mWorkerFree.notify_all();
+    return onTimeout(name, deadline);
+}
+
+int Watchdog::onTimeout(const char* name, std::chrono::milliseconds deadline) {
+    ++mTimeouts;
+    LOG(ERROR) << name << " did not complete within " << deadline.count() << " ms";
+    return recover(name) ? kTimedOut : kHung;
+}
+
+bool Watchdog::recover(const char* name) {
+    LOG(ERROR) << "RESETTING NNLIB AFTER HUNG " << name;
+    if (!Controller::getInstance().resetNnlib()) {
+        ++mFailedResets;
+        return false;
+    }
+    ++mResets;
+    Controller::getInstance().config();
+    PowerManager::getInstance().apply();
+    return true;
+}
+
+std::string Watchdog::dump() {
+    return "watchdog:\n  workers: " + std::to_string(mWorkers.size()) +
+           "\n  timeouts: " + std::to_string(mTimeouts) +
+           "\n  nnlib resets: " + std::to_string(mResets) +
+           "\n  failed nnlib resets: " + std::to_string(mFailedResets) +
+           "\n  graph rebuilds: " + std::to_string(mRebuilds) +
+           "\n  requests recovered: " + std::to_string(mRecovered) +
+           "\n  requests failed: " + std::to_string(mFailed) + "\n";
+}
+
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_V1_0_HEXAGON_WATCHDOG_H
+#define ANDROID_HARDWARE_V1_0_HEXAGON_WATCHDOG_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+
+// Supervises calls into nnlib that are known to hang. Each call runs on one
+// of a fixed set of watchdog workers (vendor.hvx.watchdog.workers) while the
+// caller waits for it with a deadline. When the deadline expires, the call is
+// abandoned and nnlib is reset so that the rest of the service can make
+// progress again. An abandoned call keeps its worker, and its arguments,
+// until it eventually returns. A caller finding every worker busy waits for
+// one, and times out the same way only if every worker is held by an
+// abandoned call past its deadline.
+class Watchdog {
+    // methods
+   private:
+    Watchdog();
+    ~Watchdog();
+    Watchdog(const Watchdog&) = delete;
+    Watchdog(Watchdog&&) = delete;
+    Watchdog& operator=(const Watchdog&) = delete;
+    Watchdog& operator=(Watchdog&&) = delete;
+
+    struct Worker;
+    void workerLoop(Worker* worker);
+    Worker* findIdleLocked();
+    int onTimeout(const char* name, std::chrono::milliseconds deadline);
+    bool recover(const char* name);
+
+   public:
+    static Watchdog& getInstance();
+
+    // returned by supervise when the deadline expired and nnlib was reset
+    static constexpr int kTimedOut = -110;  // -ETIMEDOUT
+    // returned by supervise when the deadline expired and the hung call
+    // kept nnlib from being reset
+    static constexpr int kHung = -5;  // -EIO
+
+    int supervise(const char* name, std::chrono::milliseconds deadline,
+                  std::function<int()> call);
+
+    std::chrono::milliseconds getPrepareDeadline() const { return mPrepareDeadline; }
+    std::chrono::milliseconds getExecuteDeadline() const { return mExecuteDeadline; }
+
+    // recovery bookkeeping, reported by dump
+    void onRebuild() { ++mRebuilds; }
+    void onRetry(bool success) { ++(success ? mRecovered : mFailed); }
+
+    std::string dump();
+
+    // members
+   private:
+    const std::chrono::milliseconds mPrepareDeadline;
+    const std::chrono::milliseconds mExecuteDeadline;
+
+    std::mutex mMutex;
+    std::condition_variable mWorkerFree;
+    std::vector<std::unique_ptr<Worker>> mWorkers;
+    bool mStopping;
+
+    std::atomic<uint32_t> mTimeouts;
+    std::atomic<uint32_t> mResets;
+    std::atomic<uint32_t> mFailedResets;
+    std::atomic<uint32_t> mRebuilds;
+    std::atomic<uint32_t> mRecovered;
+    std::atomic<uint32_t> mFailed;
+};
+
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_V1_0_HEXAGON_WATCHDOG_H
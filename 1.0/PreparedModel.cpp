@@ -18,7 +18,9 @@
 
 #include "PreparedModel.h"
 #include <android-base/logging.h>
-#include <thread>
+#include <android-base/properties.h>
+#include <chrono>
+#include "HexagonDispatcher.h"
 #include "HexagonUtils.h"
 
 namespace android {
@@ -29,28 +31,63 @@ namespace implementation {
 
 PreparedModel::PreparedModel(const Model& neuralNetworksModel,
                              const std::shared_ptr<hexagon::Model>& hexagonModel)
-    : mNeuralNetworksModel(neuralNetworksModel), mHexagonModel(hexagonModel) {}
+    : mValidator(neuralNetworksModel),
+      mHexagonModel(hexagonModel),
+      mBatcher(hexagon::Batcher::create(neuralNetworksModel, hexagonModel)) {
+    // models with inputs of unknown shape are lowered for each request shape
+    if (hexagonModel == nullptr) {
+        mShapes = std::make_shared<hexagon::ShapeCache>(
+            neuralNetworksModel,
+            ::android::base::GetUintProperty<uint32_t>("vendor.hvx.shape_cache.size", 4));
+    }
+}
+
+PreparedModel::PreparedModel(const hexagon::RequestValidator& validator,
+                             const std::shared_ptr<hexagon::Model>& hexagonModel)
+    : mValidator(validator), mHexagonModel(hexagonModel) {}
 
 PreparedModel::~PreparedModel() {}
 
-static void asyncExecute(const std::shared_ptr<hexagon::Model>& model, const Request& request,
-                         const sp<IExecutionCallback>& callback) {
-    ErrorStatus status =
-        model->execute(request) == true ? ErrorStatus::NONE : ErrorStatus::GENERAL_FAILURE;
+// microseconds since the request was received
+static uint64_t getDriverTime(std::chrono::steady_clock::time_point received) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - received)
+        .count();
+}
+
+static void notify(const sp<IExecutionCallback>& callback, bool success, hexagon::Timing timing,
+                   std::chrono::steady_clock::time_point received) {
+    timing.timeInDriver = getDriverTime(received);
+    hexagon::TimingReport::getInstance().record(timing);
+
+    ErrorStatus status = success ? ErrorStatus::NONE : ErrorStatus::GENERAL_FAILURE;
     Return<void> ret = callback->notify(status);
     if (!ret.isOk()) {
         LOG(ERROR) << "Error in callback's return type: " << ret.description();
     }
 }
 
+static void asyncExecute(std::shared_ptr<hexagon::Model> model,
+                         const std::shared_ptr<hexagon::ShapeCache>& shapes, const Request& request,
+                         const hexagon::Client& client, const sp<IExecutionCallback>& callback,
+                         std::chrono::steady_clock::time_point received) {
+    if (shapes != nullptr) {
+        model = shapes->get(request);
+    }
+    hexagon::Timing timing;
+    const bool success = model != nullptr && model->execute(request, client, &timing);
+    notify(callback, success, timing, received);
+}
+
 Return<ErrorStatus> PreparedModel::execute(const Request& request,
                                            const sp<IExecutionCallback>& callback) {
+    const std::chrono::steady_clock::time_point received = std::chrono::steady_clock::now();
     if (callback.get() == nullptr) {
         LOG(ERROR) << "invalid callback passed to execute";
         return ErrorStatus::INVALID_ARGUMENT;
     }
 
-    if (!nn::validateRequest(request, mNeuralNetworksModel)) {
+    if (!mValidator.validate(request)) {
         Return<void> ret = callback->notify(ErrorStatus::INVALID_ARGUMENT);
         if (!ret.isOk()) {
             LOG(ERROR) << "Error in callback's return type: " << ret.description();
@@ -65,9 +102,23 @@ Return<ErrorStatus> PreparedModel::execute(const Request& request,
         return ErrorStatus::DEVICE_UNAVAILABLE;
     }
 
-    // TODO: once nnlib hanging issue is resolved, make this function
-    // asynchronous again
-    asyncExecute(mHexagonModel, request, callback);
+    // the caller is only known on the binder thread
+    const hexagon::Client client = hexagon::getCallingClient();
+
+    if (mBatcher != nullptr && mBatcher->accepts(request)) {
+        mBatcher->enqueue(request, client,
+                          [callback, received](bool success, const hexagon::Timing& timing) {
+                              notify(callback, success, timing, received);
+                          });
+        return ErrorStatus::NONE;
+    }
+
+    // hung nnlib calls are recovered by the watchdog, so workers are not
+    // lost to them
+    hexagon::Dispatcher::getInstance().post(
+        client, [model = mHexagonModel, shapes = mShapes, request, client, callback, received]() {
+            asyncExecute(model, shapes, request, client, callback, received);
+        });
 
     return ErrorStatus::NONE;
 }
@@ -21,7 +21,10 @@
 #include <hidl/MQDescriptor.h>
 #include <hidl/Status.h>
 #include <memory>
+#include "HexagonBatcher.h"
 #include "HexagonModel.h"
+#include "HexagonRequestValidator.h"
+#include "HexagonShapeCache.h"
 #include "hexagon_nn_controller/hexagon_nn_controller.h"
 
 namespace android {
@@ -49,6 +52,9 @@ struct PreparedModel : public IPreparedModel {
    public:
     PreparedModel(const Model& neuralNetworksModel,
                   const std::shared_ptr<hexagon::Model>& hexagonModel);
+    // a model restored from the compilation cache, without its NNAPI model
+    PreparedModel(const hexagon::RequestValidator& validator,
+                  const std::shared_ptr<hexagon::Model>& hexagonModel);
     ~PreparedModel() override;
 
     // Methods from IPreparedModel follow.
@@ -56,8 +62,10 @@ struct PreparedModel : public IPreparedModel {
                                 const sp<IExecutionCallback>& callback) override;
 
    private:
-    Model mNeuralNetworksModel;
+    hexagon::RequestValidator mValidator;
     std::shared_ptr<hexagon::Model> mHexagonModel;
+    std::unique_ptr<hexagon::Batcher> mBatcher;
+    std::shared_ptr<hexagon::ShapeCache> mShapes;
 };
 
 }  // namespace implementation
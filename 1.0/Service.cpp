@@ -17,8 +17,11 @@
 #define LOG_TAG "android.hardware.neuralnetworks@1.0-service-hvx"
 
 #include <android-base/logging.h>
+#include <android-base/properties.h>
 #include <android/hardware/neuralnetworks/1.0/IDevice.h>
 #include <hidl/HidlTransportSupport.h>
+#include <algorithm>
+#include <thread>
 #include "Device.h"
 
 // Generated HIDL files
@@ -26,12 +29,17 @@ using android::hardware::neuralnetworks::V1_0::IDevice;
 using android::hardware::neuralnetworks::V1_0::implementation::Device;
 
 int main() {
-    android::sp<IDevice> device = new Device();
-    android::hardware::configureRpcThreadpool(4, true /* will join */);
+    android::sp<Device> device = new Device();
+    const size_t binderThreads = std::max<size_t>(
+        1, android::base::GetUintProperty<size_t>("vendor.hvx.threads.binder", 4));
+    android::hardware::configureRpcThreadpool(binderThreads, true /* will join */);
     if (device->registerAsService("hvx") != android::OK) {
         LOG(ERROR) << "Could not register service";
         return 1;
     }
+    if (android::base::GetBoolProperty("vendor.hvx.warmup", true)) {
+        std::thread([device]() { device->warmUp(); }).detach();
+    }
     android::hardware::joinRpcThreadpool();
     LOG(ERROR) << "Hvx service exited!";
     return 1;
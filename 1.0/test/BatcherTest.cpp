@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <vector>
+#include "HexagonBatcher.h"
+#include "HexagonModel.h"
+#include "HexagonUtils.h"
+#include "ModelBuilder.h"
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+namespace {
+
+constexpr uint32_t kBatchSize = 2;
+
+class BatcherTest : public ::testing::Test {
+   protected:
+    void SetUp() override {
+        mNeuralNetworksModel = createAddModel();
+        std::shared_ptr<Model> model = std::make_shared<Model>(mNeuralNetworksModel);
+        ASSERT_TRUE(model->prepare());
+        Batcher::setBatchSizeForTesting(kBatchSize);
+        mBatcher = Batcher::create(mNeuralNetworksModel, model);
+        Batcher::setBatchSizeForTesting(0);
+        ASSERT_NE(nullptr, mBatcher);
+        ASSERT_TRUE(createScratchRequest(mNeuralNetworksModel, &mRequest));
+    }
+
+    NeuralnetworksModel mNeuralNetworksModel;
+    std::unique_ptr<Batcher> mBatcher;
+    Request mRequest;
+};
+
+TEST_F(BatcherTest, AcceptsOneSamplePerArgument) {
+    EXPECT_TRUE(mBatcher->accepts(mRequest));
+}
+
+TEST_F(BatcherTest, RejectsShortInput) {
+    // a short argument at the end of its pool must not be copied whole
+    mRequest.inputs[0].location.offset = mRequest.pools[0].size() - 1;
+    mRequest.inputs[0].location.length = 1;
+    EXPECT_FALSE(mBatcher->accepts(mRequest));
+}
+
+TEST_F(BatcherTest, RejectsShortOutput) {
+    mRequest.outputs[0].location.length -= 1;
+    EXPECT_FALSE(mBatcher->accepts(mRequest));
+}
+
+TEST_F(BatcherTest, RejectsMissingAndShapedArguments) {
+    Request missing = mRequest;
+    missing.inputs[1] = {.hasNoValue = true, .location = {}, .dimensions = {}};
+    EXPECT_FALSE(mBatcher->accepts(missing));
+
+    Request shaped = mRequest;
+    shaped.inputs[0].dimensions = std::vector<uint32_t>{1, 2, 2, 1};
+    EXPECT_FALSE(mBatcher->accepts(shaped));
+
+    Request fewer = mRequest;
+    fewer.outputs = hidl_vec<RequestArgument>();
+    EXPECT_FALSE(mBatcher->accepts(fewer));
+}
+
+}  // anonymous namespace
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include "HexagonCompilationCache.h"
+#include "ModelBuilder.h"
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+namespace {
+
+std::vector<std::string> listFiles(const std::string& directory) {
+    std::vector<std::string> files;
+    std::unique_ptr<DIR, int (*)(DIR*)> dir(opendir(directory.c_str()), closedir);
+    while (dir != nullptr) {
+        const dirent* file = readdir(dir.get());
+        if (file == nullptr) {
+            break;
+        }
+        const std::string name = file->d_name;
+        if (name != "." && name != "..") {
+            files.push_back(directory + "/" + name);
+        }
+    }
+    return files;
+}
+
+std::vector<op_type> getOps(const Graph& graph) {
+    std::vector<op_type> ops;
+    for (const GraphNode& node : graph.getNodes()) {
+        ops.push_back(node.op);
+    }
+    return ops;
+}
+
+class CompilationCacheTest : public ::testing::Test {
+   protected:
+    void SetUp() override {
+        const std::string& root = CompilationCache::getInstance().getRoot();
+        // the root is created by the service's init script
+        for (size_t slash = root.find('/', 1); slash != std::string::npos;
+             slash = root.find('/', slash + 1)) {
+            mkdir(root.substr(0, slash).c_str(), 0770);
+        }
+        mkdir(root.c_str(), 0770);
+        mDirectory = root + "/test-" + std::to_string(getpid());
+
+        mNeuralNetworksModel = createAddModel();
+        mModel = std::make_unique<Model>(mNeuralNetworksModel);
+        ASSERT_TRUE(mModel->prepare());
+        mToken = CompilationCache::getToken(mNeuralNetworksModel);
+    }
+
+    void TearDown() override {
+        for (const std::string& file : listFiles(mDirectory)) {
+            unlink(file.c_str());
+        }
+        rmdir(mDirectory.c_str());
+    }
+
+    std::string mDirectory;
+    NeuralnetworksModel mNeuralNetworksModel;
+    std::unique_ptr<Model> mModel;
+    CacheToken mToken;
+};
+
+TEST_F(CompilationCacheTest, OwnsOnlyDirectoriesUnderTheRoot) {
+    CompilationCache& cache = CompilationCache::getInstance();
+    const std::string& root = cache.getRoot();
+    EXPECT_TRUE(cache.isOwned(root));
+    EXPECT_TRUE(cache.isOwned(mDirectory));
+    EXPECT_FALSE(cache.isOwned(root + "-sibling"));
+    EXPECT_FALSE(cache.isOwned(root + "/../escaped"));
+    EXPECT_FALSE(cache.isOwned(root + "/a/./b"));
+    EXPECT_FALSE(cache.isOwned(root + "//a"));
+    EXPECT_FALSE(cache.isOwned("/data/local/tmp"));
+}
+
+TEST_F(CompilationCacheTest, RestoresStoredModel) {
+    CompilationCache& cache = CompilationCache::getInstance();
+    const RequestValidator validator(mNeuralNetworksModel);
+    ASSERT_TRUE(cache.store(mDirectory, mToken, *mModel, validator));
+
+    CompilationCache::Entry entry;
+    ASSERT_TRUE(cache.load(mDirectory, mToken, &entry));
+    ASSERT_NE(nullptr, entry.model);
+    EXPECT_EQ(getOps(mModel->getRecipe()), getOps(entry.model->getRecipe()));
+    ASSERT_EQ(validator.getInputs().size(), entry.inputs.size());
+    ASSERT_EQ(validator.getOutputs().size(), entry.outputs.size());
+    EXPECT_EQ(validator.getInputs()[0].toVector(), entry.inputs[0].toVector());
+
+    // constants are read in place from the entry
+    const std::vector<GraphNode>& stored = mModel->getRecipe().getNodes();
+    const std::vector<GraphNode>& restored = entry.model->getRecipe().getNodes();
+    for (size_t i = 0; i < stored.size(); ++i) {
+        ASSERT_EQ(stored[i].size, restored[i].size);
+        EXPECT_EQ(0, std::memcmp(stored[i].getData(), restored[i].getData(), stored[i].size));
+    }
+}
+
+TEST_F(CompilationCacheTest, MissesOtherTokens) {
+    CompilationCache& cache = CompilationCache::getInstance();
+    ASSERT_TRUE(cache.store(mDirectory, mToken, *mModel, RequestValidator(mNeuralNetworksModel)));
+
+    CacheToken other = mToken;
+    other[0] ^= 1;
+    CompilationCache::Entry entry;
+    EXPECT_FALSE(cache.load(mDirectory, other, &entry));
+}
+
+TEST_F(CompilationCacheTest, RejectsAndRemovesCorruptedEntry) {
+    CompilationCache& cache = CompilationCache::getInstance();
+    ASSERT_TRUE(cache.store(mDirectory, mToken, *mModel, RequestValidator(mNeuralNetworksModel)));
+    const std::vector<std::string> files = listFiles(mDirectory);
+    ASSERT_EQ(1u, files.size());
+
+    // flip a byte of the payload, at the end of the file
+    const int fd = open(files[0].c_str(), O_RDWR | O_CLOEXEC);
+    ASSERT_GE(fd, 0);
+    const off_t last = lseek(fd, -1, SEEK_END);
+    uint8_t byte = 0;
+    ASSERT_EQ(1, pread(fd, &byte, 1, last));
+    byte ^= 0xff;
+    ASSERT_EQ(1, pwrite(fd, &byte, 1, last));
+    close(fd);
+
+    CompilationCache::Entry entry;
+    EXPECT_FALSE(cache.load(mDirectory, mToken, &entry));
+    EXPECT_TRUE(listFiles(mDirectory).empty());
+}
+
+TEST_F(CompilationCacheTest, TokenCoversConstantValues) {
+    NeuralnetworksModel changed = mNeuralNetworksModel;
+    ASSERT_NE(0u, changed.operandValues.size());
+    changed.operandValues[0] ^= 1;
+    EXPECT_NE(mToken, CompilationCache::getToken(changed));
+    EXPECT_EQ(mToken, CompilationCache::getToken(mNeuralNetworksModel));
+}
+
+}  // anonymous namespace
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
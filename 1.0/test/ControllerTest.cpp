@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <thread>
+#include "FakeNnlib.h"
+#include "HexagonController.h"
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+namespace {
+
+void waitFor(const std::function<bool()>& condition) {
+    while (!condition()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+// an execution of graph id, blocked in nnlib until executions are released
+std::future<int> startHeldExecution(hexagon_nn_nn_id id) {
+    const size_t held = fake_nnlib::getHeldExecutions();
+    std::future<int> execution = std::async(std::launch::async, [id]() {
+        return Controller::getInstance().execute_new(id, nullptr, 0, nullptr, 0);
+    });
+    waitFor([held]() { return fake_nnlib::getHeldExecutions() == held + 1; });
+    return execution;
+}
+
+class ControllerTest : public ::testing::Test {
+   protected:
+    void SetUp() override {
+        // nothing else in the process uses nnlib while these tests run
+        ASSERT_EQ(0u, fake_nnlib::getLiveGraphs());
+    }
+
+    void TearDown() override {
+        fake_nnlib::holdExecutions(false);
+        fake_nnlib::reload();
+    }
+};
+
+TEST_F(ControllerTest, ResetWaitsForCallsInFlight) {
+    Controller& controller = Controller::getInstance();
+    hexagon_nn_nn_id id = 0;
+    uint64_t generation = 0;
+    ASSERT_EQ(0, controller.init(&id, &generation));
+    EXPECT_EQ(controller.getGeneration(), generation);
+
+    fake_nnlib::holdExecutions(true);
+    std::future<int> execution = startHeldExecution(id);
+    std::future<bool> reset =
+        std::async(std::launch::async, [&controller]() { return controller.resetNnlib(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_EQ(generation, controller.getGeneration());
+
+    fake_nnlib::holdExecutions(false);
+    EXPECT_EQ(0, execution.get());
+    EXPECT_TRUE(reset.get());
+    EXPECT_EQ(generation + 1, controller.getGeneration());
+    EXPECT_FALSE(controller.isHung());
+}
+
+TEST_F(ControllerTest, ResetFailsOnHungCall) {
+    Controller& controller = Controller::getInstance();
+    hexagon_nn_nn_id id = 0;
+    uint64_t generation = 0;
+    ASSERT_EQ(0, controller.init(&id, &generation));
+
+    // the library cannot be reloaded from under the call, so the graphs in
+    // it stay valid
+    fake_nnlib::holdExecutions(true);
+    std::future<int> execution = startHeldExecution(id);
+    EXPECT_FALSE(controller.resetNnlib());
+    EXPECT_EQ(generation, controller.getGeneration());
+    EXPECT_TRUE(controller.isHung());
+    EXPECT_EQ(1u, fake_nnlib::getLiveGraphs());
+
+    fake_nnlib::holdExecutions(false);
+    EXPECT_EQ(0, execution.get());
+    EXPECT_FALSE(controller.isHung());
+    EXPECT_EQ(0, controller.teardown(id, generation));
+    EXPECT_EQ(0u, fake_nnlib::getLiveGraphs());
+}
+
+TEST_F(ControllerTest, SerializesCallsOnOneGraph) {
+    Controller& controller = Controller::getInstance();
+    hexagon_nn_nn_id first = 0;
+    hexagon_nn_nn_id second = 0;
+    uint64_t generation = 0;
+    ASSERT_EQ(0, controller.init(&first, &generation));
+    ASSERT_EQ(0, controller.init(&second, &generation));
+
+    fake_nnlib::holdExecutions(true);
+    std::future<int> running = startHeldExecution(first);
+    std::future<int> other = startHeldExecution(second);
+    std::future<int> waiting = std::async(std::launch::async, [&controller, first]() {
+        return controller.execute_new(first, nullptr, 0, nullptr, 0);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_EQ(2u, fake_nnlib::getHeldExecutions());
+
+    fake_nnlib::holdExecutions(false);
+    EXPECT_EQ(0, running.get());
+    EXPECT_EQ(0, other.get());
+    EXPECT_EQ(0, waiting.get());
+    EXPECT_EQ(0, controller.teardown(first, generation));
+    EXPECT_EQ(0, controller.teardown(second, generation));
+}
+
+TEST_F(ControllerTest, StaleTeardownSparesGraphOfNextGeneration) {
+    Controller& controller = Controller::getInstance();
+    hexagon_nn_nn_id stale = 0;
+    uint64_t staleGeneration = 0;
+    ASSERT_EQ(0, controller.init(&stale, &staleGeneration));
+    ASSERT_TRUE(controller.resetNnlib());
+    fake_nnlib::reload();
+
+    // the reloaded nnlib hands the same id to another graph
+    hexagon_nn_nn_id live = 0;
+    uint64_t generation = 0;
+    ASSERT_EQ(0, controller.init(&live, &generation));
+    ASSERT_EQ(stale, live);
+    EXPECT_NE(staleGeneration, generation);
+
+    EXPECT_EQ(-1, controller.teardown(stale, staleGeneration));
+    EXPECT_EQ(1u, fake_nnlib::getLiveGraphs());
+    EXPECT_EQ(0, controller.teardown(live, generation));
+    EXPECT_EQ(0u, fake_nnlib::getLiveGraphs());
+}
+
+}  // anonymous namespace
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
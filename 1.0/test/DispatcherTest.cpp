@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "HexagonDispatcher.h"
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+namespace {
+
+// Runs executions on a DSP that admits one at a time, and records the order
+// they ran in. The DSP is held by a blocking execution until every other one
+// is queued, so that the order is up to the Dispatcher alone.
+class DispatcherTest : public ::testing::Test {
+   protected:
+    void SetUp() override {
+        Dispatcher::getInstance().setLimitForTesting(1);
+        std::future<void> blocking = mBlocking.get_future();
+        std::future<void> released = mReleased.get_future();
+        mThreads.emplace_back([this, released = std::move(released)]() mutable {
+            const Client blocker{.workload = WorkloadClass::INTERACTIVE, .pid = 1};
+            Dispatcher::getInstance().dispatch(blocker, 1, [this, &released]() {
+                mBlocking.set_value();
+                released.wait();
+                return 0;
+            });
+        });
+        blocking.wait();
+    }
+
+    void TearDown() override {
+        for (std::thread& thread : mThreads) {
+            thread.join();
+        }
+        Dispatcher::getInstance().setLimitForTesting(0);
+    }
+
+    // queues an execution of cost for client, labelled name
+    void queue(const Client& client, uint64_t cost, const std::string& name) {
+        const size_t queued = Dispatcher::getInstance().getQueued();
+        mThreads.emplace_back([this, client, cost, name]() {
+            Dispatcher::getInstance().dispatch(client, cost, [this, &name]() {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mOrder.push_back(name);
+                return 0;
+            });
+        });
+        waitForQueued(queued + 1);
+    }
+
+    // runs the queued executions, and returns the order they ran in
+    std::vector<std::string> run() {
+        mReleased.set_value();
+        for (std::thread& thread : mThreads) {
+            thread.join();
+        }
+        mThreads.clear();
+        return mOrder;
+    }
+
+   private:
+    static void waitForQueued(size_t queued) {
+        while (Dispatcher::getInstance().getQueued() != queued) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    std::promise<void> mBlocking;
+    std::promise<void> mReleased;
+    std::vector<std::thread> mThreads;
+    std::mutex mMutex;
+    std::vector<std::string> mOrder;
+};
+
+TEST_F(DispatcherTest, AdmitsClassesByPriority) {
+    queue({.workload = WorkloadClass::BACKGROUND, .pid = 100}, 10, "background");
+    queue({.workload = WorkloadClass::NORMAL, .pid = 101}, 10, "normal");
+    queue({.workload = WorkloadClass::INTERACTIVE, .pid = 102}, 10, "interactive");
+    EXPECT_EQ((std::vector<std::string>{"interactive", "normal", "background"}), run());
+}
+
+TEST_F(DispatcherTest, SharesClassBetweenClients) {
+    // a client flooding the class does not hold back one that arrives later
+    const Client flooding{.workload = WorkloadClass::NORMAL, .pid = 200};
+    queue(flooding, 10, "flooding");
+    queue(flooding, 10, "flooding");
+    queue(flooding, 10, "flooding");
+    queue({.workload = WorkloadClass::NORMAL, .pid = 201}, 10, "late");
+    EXPECT_EQ((std::vector<std::string>{"flooding", "late", "flooding", "flooding"}), run());
+}
+
+TEST_F(DispatcherTest, ChargesClientsForTheirCost) {
+    // after its first execution, a client of expensive executions waits for
+    // the cheap ones of another
+    const Client expensive{.workload = WorkloadClass::NORMAL, .pid = 300};
+    const Client cheap{.workload = WorkloadClass::NORMAL, .pid = 301};
+    queue(expensive, 40, "expensive");
+    queue(expensive, 40, "expensive");
+    queue(cheap, 10, "cheap");
+    queue(cheap, 10, "cheap");
+    queue(cheap, 10, "cheap");
+    EXPECT_EQ((std::vector<std::string>{"expensive", "cheap", "cheap", "cheap", "expensive"}),
+              run());
+}
+
+}  // anonymous namespace
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
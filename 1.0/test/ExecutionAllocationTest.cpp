@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include "FakeNnlib.h"
+#include "HexagonModel.h"
+#include "HexagonUtils.h"
+#include "ModelBuilder.h"
+
+namespace {
+
+// heap allocations made by any thread while counting
+std::atomic<bool> gCounting(false);
+std::atomic<uint64_t> gAllocations(0);
+
+}  // anonymous namespace
+
+void* operator new(size_t size) {
+    if (gCounting) {
+        ++gAllocations;
+    }
+    void* memory = std::malloc(size != 0 ? size : 1);
+    if (memory == nullptr) {
+        std::abort();
+    }
+    return memory;
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+    std::free(memory);
+}
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+namespace {
+
+constexpr uint32_t kWarmUpExecutions = 8;
+constexpr uint32_t kCountedExecutions = 100;
+
+TEST(ExecutionAllocationTest, ExecutionOnMappedPoolsDoesNotAllocate) {
+    const NeuralnetworksModel neuralNetworksModel = createAddModel();
+    Model model(neuralNetworksModel);
+    ASSERT_TRUE(model.prepare());
+
+    Request request;
+    ASSERT_TRUE(createScratchRequest(neuralNetworksModel, &request));
+    MappedPools pools;
+    ASSERT_TRUE(mapPools(request.pools, &pools));
+
+    // the first executions set up the bindings, the replica, the fair
+    // queuing state of the client and the watchdog worker
+    const Client client{.workload = WorkloadClass::NORMAL, .pid = 1};
+    Timing timing;
+    for (uint32_t i = 0; i < kWarmUpExecutions; ++i) {
+        ASSERT_TRUE(model.execute(request, pools, client, &timing));
+    }
+
+    const uint64_t executions = fake_nnlib::getExecutions();
+    bool success = true;
+    gAllocations = 0;
+    gCounting = true;
+    for (uint32_t i = 0; i < kCountedExecutions; ++i) {
+        success = model.execute(request, pools, client, &timing) && success;
+    }
+    gCounting = false;
+
+    EXPECT_TRUE(success);
+    EXPECT_EQ(executions + kCountedExecutions, fake_nnlib::getExecutions());
+    EXPECT_EQ(0u, gAllocations.load());
+}
+
+}  // anonymous namespace
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
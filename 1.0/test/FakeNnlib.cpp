@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "FakeNnlib.h"
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include "hexagon_nn_controller/hexagon_nn_controller.h"
+
+namespace fake_nnlib {
+
+namespace {
+
+// version the driver expects of nnlib
+constexpr int kVersion = 92;
+
+std::mutex gMutex;
+std::map<hexagon_nn_nn_id, size_t> gGraphs;
+hexagon_nn_nn_id gNextId = 1;
+uint64_t gExecutions = 0;
+std::condition_variable gReleased;
+bool gHeld = false;
+size_t gHeldExecutions = 0;
+
+}  // anonymous namespace
+
+size_t getLiveGraphs() {
+    std::lock_guard<std::mutex> lock(gMutex);
+    return gGraphs.size();
+}
+
+size_t getNodeCount(int id) {
+    std::lock_guard<std::mutex> lock(gMutex);
+    auto graph = gGraphs.find(id);
+    return graph != gGraphs.end() ? graph->second : 0;
+}
+
+uint64_t getExecutions() {
+    std::lock_guard<std::mutex> lock(gMutex);
+    return gExecutions;
+}
+
+void holdExecutions(bool held) {
+    {
+        std::lock_guard<std::mutex> lock(gMutex);
+        gHeld = held;
+    }
+    gReleased.notify_all();
+}
+
+size_t getHeldExecutions() {
+    std::lock_guard<std::mutex> lock(gMutex);
+    return gHeldExecutions;
+}
+
+void reload() {
+    std::lock_guard<std::mutex> lock(gMutex);
+    gGraphs.clear();
+    gNextId = 1;
+}
+
+}  // namespace fake_nnlib
+
+using fake_nnlib::gExecutions;
+using fake_nnlib::gGraphs;
+using fake_nnlib::gHeld;
+using fake_nnlib::gHeldExecutions;
+using fake_nnlib::gMutex;
+using fake_nnlib::gNextId;
+using fake_nnlib::gReleased;
+
+extern "C" {
+
+int hexagon_nn_controller_init(hexagon_nn_nn_id* g) {
+    std::lock_guard<std::mutex> lock(gMutex);
+    *g = gNextId++;
+    gGraphs[*g] = 0;
+    return 0;
+}
+
+int hexagon_nn_controller_getlog(hexagon_nn_nn_id, unsigned char* buf, unsigned int length) {
+    if (length > 0) {
+        buf[0] = '\0';
+    }
+    return 0;
+}
+
+int hexagon_nn_controller_snpprint(hexagon_nn_nn_id, unsigned char* buf, unsigned int length) {
+    if (length > 0) {
+        buf[0] = '\0';
+    }
+    return 0;
+}
+
+int hexagon_nn_controller_set_debug_level(hexagon_nn_nn_id, int) {
+    return 0;
+}
+
+int hexagon_nn_controller_prepare(hexagon_nn_nn_id id) {
+    std::lock_guard<std::mutex> lock(gMutex);
+    return gGraphs.count(id) != 0 ? 0 : -1;
+}
+
+int hexagon_nn_controller_append_node(hexagon_nn_nn_id id, unsigned int, op_type,
+                                      hexagon_nn_padding_type, const hexagon_nn_input*,
+                                      unsigned int, const hexagon_nn_output*, unsigned int) {
+    std::lock_guard<std::mutex> lock(gMutex);
+    auto graph = gGraphs.find(id);
+    if (graph == gGraphs.end()) {
+        return -1;
+    }
+    ++graph->second;
+    return 0;
+}
+
+int hexagon_nn_controller_append_const_node(hexagon_nn_nn_id id, unsigned int, unsigned int,
+                                            unsigned int, unsigned int, unsigned int,
+                                            const unsigned char*, unsigned int) {
+    std::lock_guard<std::mutex> lock(gMutex);
+    auto graph = gGraphs.find(id);
+    if (graph == gGraphs.end()) {
+        return -1;
+    }
+    ++graph->second;
+    return 0;
+}
+
+int hexagon_nn_controller_execute_new(hexagon_nn_nn_id id, const hexagon_nn_tensordef*,
+                                      unsigned int, hexagon_nn_tensordef*, unsigned int) {
+    // looking up the graph does not allocate, as the driver's execution path
+    // is checked for allocations
+    std::unique_lock<std::mutex> lock(gMutex);
+    if (gHeld) {
+        ++gHeldExecutions;
+        gReleased.wait(lock, []() { return !gHeld; });
+        --gHeldExecutions;
+    }
+    if (gGraphs.find(id) == gGraphs.end()) {
+        return -1;
+    }
+    ++gExecutions;
+    return 0;
+}
+
+int hexagon_nn_controller_execute(hexagon_nn_nn_id, unsigned int, unsigned int, unsigned int,
+                                  unsigned int, const unsigned char*, unsigned int,
+                                  unsigned int*, unsigned int*, unsigned int*, unsigned int*,
+                                  unsigned char*, unsigned int, unsigned int*) {
+    return -1;
+}
+
+int hexagon_nn_controller_teardown(hexagon_nn_nn_id id) {
+    std::lock_guard<std::mutex> lock(gMutex);
+    return gGraphs.erase(id) != 0 ? 0 : -1;
+}
+
+int hexagon_nn_controller_get_perfinfo(hexagon_nn_nn_id, hexagon_nn_perfinfo*, unsigned int,
+                                       unsigned int* n_items_out) {
+    *n_items_out = 0;
+    return 0;
+}
+
+int hexagon_nn_controller_reset_perfinfo(hexagon_nn_nn_id, unsigned int) {
+    return 0;
+}
+
+int hexagon_nn_controller_version(int* ver) {
+    *ver = fake_nnlib::kVersion;
+    return 0;
+}
+
+int hexagon_nn_controller_last_execution_cycles(hexagon_nn_nn_id, unsigned int* cycles_lo,
+                                                unsigned int* cycles_hi) {
+    *cycles_lo = fake_nnlib::kCyclesPerExecution;
+    *cycles_hi = 0;
+    return 0;
+}
+
+int hexagon_nn_controller_GetHexagonBinaryVersion(int* ver) {
+    *ver = fake_nnlib::kVersion;
+    return 0;
+}
+
+int hexagon_nn_controller_PrintLog(const unsigned char*, unsigned int) {
+    return 0;
+}
+
+int hexagon_nn_controller_op_name_to_id(const char*, unsigned int* id) {
+    *id = 0;
+    return 0;
+}
+
+int hexagon_nn_controller_op_id_to_name(const unsigned int, char* name, int name_len) {
+    if (name_len > 0) {
+        name[0] = '\0';
+    }
+    return 0;
+}
+
+int hexagon_nn_controller_disable_dcvs() {
+    return 0;
+}
+
+int hexagon_nn_controller_set_powersave_level(unsigned int) {
+    return 0;
+}
+
+int hexagon_nn_controller_config() {
+    return 0;
+}
+
+unsigned int hexagon_nn_controller_get_dsp_offset() {
+    return 0;
+}
+
+int hexagon_nn_controller_boost(int) {
+    return 0;
+}
+
+int hexagon_nn_controller_slow() {
+    return 0;
+}
+
+}  // extern "C"
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_V1_0_HEXAGON_FAKE_NNLIB_H
+#define ANDROID_HARDWARE_V1_0_HEXAGON_FAKE_NNLIB_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Stand-in for libhexagon_nn_controller.so, loaded by the Controller in the
+// tests. Graphs are only recorded; every call succeeds, executions leave the
+// outputs untouched, and each one reports kCyclesPerExecution.
+namespace fake_nnlib {
+
+constexpr uint32_t kCyclesPerExecution = 1000;
+
+// graphs initialized and not torn down
+size_t getLiveGraphs();
+// nodes appended to graph id, constant nodes included
+size_t getNodeCount(int id);
+uint64_t getExecutions();
+
+// While held, executions block in nnlib until released, as a hung DSP call
+// would.
+void holdExecutions(bool held);
+size_t getHeldExecutions();
+
+// Forgets every graph and hands out ids from the start again, as a freshly
+// loaded nnlib would. The library itself stays loaded across a reset, as
+// the tests link it.
+void reload();
+
+}  // namespace fake_nnlib
+
+#endif  // ANDROID_HARDWARE_V1_0_HEXAGON_FAKE_NNLIB_H
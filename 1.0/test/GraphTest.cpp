@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <vector>
+#include "HexagonGraph.h"
+#include "HexagonUtils.h"
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+namespace {
+
+// bytes of the activations in the tests
+constexpr uint32_t kSmall = 4;
+constexpr uint32_t kLarge = 4000;
+
+hexagon_nn_output createOutput(uint32_t bytes) {
+    return make_hexagon_nn_output({1, 1, 1, bytes / 4}, 4);
+}
+
+uint32_t addNode(Graph* graph, op_type op, const std::vector<uint32_t>& sources,
+                 uint32_t bytes) {
+    std::vector<hexagon_nn_input> inputs;
+    for (uint32_t source : sources) {
+        inputs.push_back({.src_id = source, .output_idx = 0});
+    }
+    std::vector<hexagon_nn_output> outputs;
+    if (op != OP_OUTPUT) {
+        outputs.push_back(createOutput(bytes));
+    }
+    return graph->addNode(op, NN_PAD_NA, inputs, outputs);
+}
+
+std::vector<uint32_t> getOrder(const Graph& graph) {
+    std::vector<uint32_t> order;
+    for (const GraphNode& node : graph.getNodes()) {
+        order.push_back(node.id);
+    }
+    return order;
+}
+
+// Whether every node comes after the nodes it reads.
+bool isTopological(const Graph& graph) {
+    std::vector<uint32_t> seen;
+    for (const GraphNode& node : graph.getNodes()) {
+        for (const hexagon_nn_input& input : node.inputs) {
+            if (std::find(seen.begin(), seen.end(), input.src_id) == seen.end()) {
+                return false;
+            }
+        }
+        seen.push_back(node.id);
+    }
+    return true;
+}
+
+TEST(GraphTest, ScheduleConsumesLargeActivationsFirst) {
+    // in feeds a and b, both large; a feeds c, b feeds d, both small; c and
+    // d feed e, the output
+    Graph graph;
+    const uint32_t in = addNode(&graph, OP_INPUT, {}, kSmall);
+    const uint32_t a = addNode(&graph, OP_Nop, {in}, kLarge);
+    const uint32_t b = addNode(&graph, OP_Nop, {in}, kLarge);
+    const uint32_t c = addNode(&graph, OP_Nop, {a}, kSmall);
+    const uint32_t d = addNode(&graph, OP_Nop, {b}, kSmall);
+    const uint32_t e = addNode(&graph, OP_Nop, {c, d}, kSmall);
+    const uint32_t out = addNode(&graph, OP_OUTPUT, {e}, 0);
+
+    graph.schedule();
+
+    // in model order, a and b are live at once
+    EXPECT_TRUE(isTopological(graph));
+    EXPECT_EQ((std::vector<uint32_t>{in, a, c, b, d, e, out}), getOrder(graph));
+}
+
+TEST(GraphTest, ScheduleKeepsConstantsFirstAndOutputLast) {
+    Graph graph;
+    const uint8_t value[4] = {};
+    const uint32_t in = addNode(&graph, OP_INPUT, {}, kSmall);
+    const uint32_t a = addNode(&graph, OP_Nop, {in}, kLarge);
+    const uint32_t constant = graph.addConstNode(1, 1, 1, 1, value, sizeof(value));
+    const uint32_t b = addNode(&graph, OP_Nop, {in}, kLarge);
+    const uint32_t c = addNode(&graph, OP_Nop, {a, constant}, kSmall);
+    const uint32_t d = addNode(&graph, OP_Nop, {b, c}, kSmall);
+    const uint32_t out = addNode(&graph, OP_OUTPUT, {d}, 0);
+
+    graph.schedule();
+
+    const std::vector<uint32_t> order = getOrder(graph);
+    ASSERT_EQ(7u, order.size());
+    EXPECT_TRUE(isTopological(graph));
+    EXPECT_EQ(out, order.back());
+    EXPECT_TRUE(std::is_permutation(order.begin(), order.end(),
+                                    std::vector<uint32_t>{in, a, constant, b, c, d, out}.begin()));
+    // constants and inputs lead, in model order
+    EXPECT_EQ(in, order[0]);
+    EXPECT_EQ(constant, order[1]);
+}
+
+TEST(GraphTest, ScheduleKeepsModelOrderWithoutGain) {
+    Graph graph;
+    const uint32_t in = addNode(&graph, OP_INPUT, {}, kSmall);
+    const uint32_t a = addNode(&graph, OP_Nop, {in}, kLarge);
+    const uint32_t b = addNode(&graph, OP_Nop, {a}, kLarge);
+    const uint32_t c = addNode(&graph, OP_Nop, {b}, kSmall);
+    const uint32_t out = addNode(&graph, OP_OUTPUT, {c}, 0);
+
+    graph.schedule();
+
+    EXPECT_EQ((std::vector<uint32_t>{in, a, b, c, out}), getOrder(graph));
+}
+
+}  // anonymous namespace
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <cstdint>
+#include "FakeNnlib.h"
+#include "HexagonMemoryBudget.h"
+#include "HexagonModel.h"
+#include "HexagonUtils.h"
+#include "ModelBuilder.h"
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+namespace {
+
+class MemoryBudgetTest : public ::testing::Test {
+   protected:
+    void TearDown() override {
+        MemoryBudget& budget = MemoryBudget::getInstance();
+        budget.forget(&mFirst);
+        budget.forget(&mSecond);
+        budget.setDspBudgetForTesting(0);
+    }
+
+    // owners of the reservations made by the tests
+    int mFirst;
+    int mSecond;
+};
+
+TEST_F(MemoryBudgetTest, UnlimitedBudgetFitsAnything) {
+    MemoryBudget& budget = MemoryBudget::getInstance();
+    budget.setDspBudgetForTesting(0);
+    EXPECT_TRUE(budget.fits(UINT64_MAX / 2));
+    EXPECT_TRUE(budget.reserve(&mFirst, UINT64_MAX / 2));
+}
+
+TEST_F(MemoryBudgetTest, RejectsReservationsOverTheBudget) {
+    MemoryBudget& budget = MemoryBudget::getInstance();
+    budget.setDspBudgetForTesting(100);
+    ASSERT_TRUE(budget.reserve(&mFirst, 60));
+    EXPECT_TRUE(budget.fits(40));
+    EXPECT_FALSE(budget.fits(41));
+
+    // a rejected reservation takes nothing
+    EXPECT_FALSE(budget.reserve(&mSecond, 41));
+    EXPECT_TRUE(budget.reserve(&mSecond, 40));
+    EXPECT_FALSE(budget.fits(1));
+
+    budget.release(&mFirst, 60);
+    EXPECT_TRUE(budget.fits(60));
+    EXPECT_FALSE(budget.fits(61));
+}
+
+TEST_F(MemoryBudgetTest, ReleasesNoMoreThanTheOwnerReserved) {
+    MemoryBudget& budget = MemoryBudget::getInstance();
+    budget.setDspBudgetForTesting(100);
+    ASSERT_TRUE(budget.reserve(&mFirst, 30));
+    ASSERT_TRUE(budget.reserve(&mSecond, 70));
+
+    budget.release(&mFirst, 50);
+    EXPECT_TRUE(budget.fits(30));
+    EXPECT_FALSE(budget.fits(31));
+
+    budget.forget(&mSecond);
+    EXPECT_TRUE(budget.fits(100));
+}
+
+TEST_F(MemoryBudgetTest, ModelOverTheBudgetFailsToPrepare) {
+    const NeuralnetworksModel neuralNetworksModel = createAddModel();
+    Model model(neuralNetworksModel);
+    ASSERT_TRUE(model.prepare());
+    const uint64_t dspBytes = model.getRecipe().getDspBytes();
+    ASSERT_NE(0u, dspBytes);
+
+    MemoryBudget::getInstance().setDspBudgetForTesting(dspBytes - 1);
+    Model other(neuralNetworksModel);
+    EXPECT_FALSE(other.prepare());
+}
+
+TEST_F(MemoryBudgetTest, EvictsIdleGraphsToMakeRoom) {
+    const NeuralnetworksModel neuralNetworksModel = createAddModel();
+    Model first(neuralNetworksModel);
+    ASSERT_TRUE(first.prepare());
+    const size_t liveGraphs = fake_nnlib::getLiveGraphs();
+
+    // room for one graph at a time
+    MemoryBudget::getInstance().setDspBudgetForTesting(first.getRecipe().getDspBytes());
+    Model second(neuralNetworksModel);
+    ASSERT_TRUE(second.prepare());
+    EXPECT_EQ(liveGraphs, fake_nnlib::getLiveGraphs());
+
+    // the first model is materialized again, in place of the second
+    Request request;
+    ASSERT_TRUE(createScratchRequest(neuralNetworksModel, &request));
+    MappedPools pools;
+    ASSERT_TRUE(mapPools(request.pools, &pools));
+    EXPECT_TRUE(first.execute(request, pools, Client{}));
+    EXPECT_EQ(liveGraphs, fake_nnlib::getLiveGraphs());
+    EXPECT_TRUE(second.execute(request, pools, Client{}));
+    EXPECT_EQ(liveGraphs, fake_nnlib::getLiveGraphs());
+}
+
+}  // anonymous namespace
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_V1_0_HEXAGON_MODEL_BUILDER_H
+#define ANDROID_HARDWARE_V1_0_HEXAGON_MODEL_BUILDER_H
+
+#include <android/hardware/neuralnetworks/1.0/types.h>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+
+// Builds NNAPI models for the tests. Constant values are copied into the
+// model, and the consumers of every operand are counted by build.
+class ModelBuilder {
+   public:
+    uint32_t addInput(OperandType type, const std::vector<uint32_t>& dimensions,
+                      float scale = 0.0f, int32_t zeroPoint = 0) {
+        const uint32_t operand = addOperand(type, dimensions, scale, zeroPoint,
+                                            OperandLifeTime::MODEL_INPUT);
+        mInputs.push_back(operand);
+        return operand;
+    }
+
+    uint32_t addOutput(OperandType type, const std::vector<uint32_t>& dimensions,
+                       float scale = 0.0f, int32_t zeroPoint = 0) {
+        const uint32_t operand = addOperand(type, dimensions, scale, zeroPoint,
+                                            OperandLifeTime::MODEL_OUTPUT);
+        mOutputs.push_back(operand);
+        return operand;
+    }
+
+    uint32_t addTemporary(OperandType type, const std::vector<uint32_t>& dimensions,
+                          float scale = 0.0f, int32_t zeroPoint = 0) {
+        return addOperand(type, dimensions, scale, zeroPoint,
+                          OperandLifeTime::TEMPORARY_VARIABLE);
+    }
+
+    template <typename Type>
+    uint32_t addConstant(OperandType type, const std::vector<uint32_t>& dimensions,
+                         const std::vector<Type>& values, float scale = 0.0f,
+                         int32_t zeroPoint = 0) {
+        const uint32_t operand = addOperand(type, dimensions, scale, zeroPoint,
+                                            OperandLifeTime::CONSTANT_COPY);
+        const uint32_t length = values.size() * sizeof(Type);
+        const uint32_t offset = (mValues.size() + 7) & ~7u;
+        mValues.resize(offset + length);
+        std::memcpy(mValues.data() + offset, values.data(), length);
+        mOperands[operand].location = {.poolIndex = 0, .offset = offset, .length = length};
+        return operand;
+    }
+
+    uint32_t addInt32(int32_t value) {
+        return addConstant(OperandType::INT32, {}, std::vector<int32_t>{value});
+    }
+
+    void addOperation(OperationType type, const std::vector<uint32_t>& inputs,
+                      const std::vector<uint32_t>& outputs) {
+        mOperations.push_back({.type = type, .inputs = inputs, .outputs = outputs});
+    }
+
+    ::android::hardware::neuralnetworks::V1_0::Model build() const {
+        std::vector<Operand> operands = mOperands;
+        for (const Operation& operation : mOperations) {
+            for (uint32_t input : operation.inputs) {
+                ++operands[input].numberOfConsumers;
+            }
+        }
+        ::android::hardware::neuralnetworks::V1_0::Model model;
+        model.operands = operands;
+        model.operations = mOperations;
+        model.inputIndexes = mInputs;
+        model.outputIndexes = mOutputs;
+        model.operandValues = mValues;
+        return model;
+    }
+
+   private:
+    uint32_t addOperand(OperandType type, const std::vector<uint32_t>& dimensions, float scale,
+                        int32_t zeroPoint, OperandLifeTime lifetime) {
+        Operand operand;
+        operand.type = type;
+        operand.dimensions = dimensions;
+        operand.numberOfConsumers = 0;
+        operand.scale = scale;
+        operand.zeroPoint = zeroPoint;
+        operand.lifetime = lifetime;
+        operand.location = {.poolIndex = 0, .offset = 0, .length = 0};
+        mOperands.push_back(operand);
+        return mOperands.size() - 1;
+    }
+
+    std::vector<Operand> mOperands;
+    std::vector<Operation> mOperations;
+    std::vector<uint32_t> mInputs;
+    std::vector<uint32_t> mOutputs;
+    std::vector<uint8_t> mValues;
+};
+
+// Quantized ADD of two [1, 2, 2, 1] inputs, without activation. Float
+// operations are not supported by the driver.
+inline ::android::hardware::neuralnetworks::V1_0::Model createAddModel() {
+    ModelBuilder builder;
+    const uint32_t a = builder.addInput(OperandType::TENSOR_QUANT8_ASYMM, {1, 2, 2, 1}, 1.0f);
+    const uint32_t b = builder.addInput(OperandType::TENSOR_QUANT8_ASYMM, {1, 2, 2, 1}, 1.0f);
+    const uint32_t activation = builder.addInt32(0);
+    const uint32_t sum = builder.addOutput(OperandType::TENSOR_QUANT8_ASYMM, {1, 2, 2, 1}, 1.0f);
+    builder.addOperation(OperationType::ADD, {a, b, activation}, {sum});
+    return builder.build();
+}
+
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_V1_0_HEXAGON_MODEL_BUILDER_H
@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include "HexagonModel.h"
+#include "ModelBuilder.h"
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+namespace {
+
+constexpr OperandType kQuant8 = OperandType::TENSOR_QUANT8_ASYMM;
+
+size_t countNodes(const Graph& graph, op_type op) {
+    const std::vector<GraphNode>& nodes = graph.getNodes();
+    return std::count_if(nodes.begin(), nodes.end(),
+                         [op](const GraphNode& node) { return node.op == op; });
+}
+
+bool hasConstant(const Graph& graph, const std::vector<uint8_t>& values) {
+    for (const GraphNode& node : graph.getNodes()) {
+        if (node.op == OP_Const && node.size == values.size() &&
+            std::memcmp(node.getData(), values.data(), values.size()) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+TEST(ModelPrepareTest, FoldsOperationsOnConstants) {
+    // in + (c1 + c2)
+    ModelBuilder builder;
+    const uint32_t in = builder.addInput(kQuant8, {1, 2, 2, 1}, 1.0f);
+    const uint32_t c1 = builder.addConstant(kQuant8, {1, 2, 2, 1},
+                                            std::vector<uint8_t>{1, 2, 3, 4}, 1.0f);
+    const uint32_t c2 = builder.addConstant(kQuant8, {1, 2, 2, 1},
+                                            std::vector<uint8_t>{10, 20, 30, 40}, 1.0f);
+    const uint32_t none = builder.addInt32(0);
+    const uint32_t sum = builder.addTemporary(kQuant8, {1, 2, 2, 1}, 1.0f);
+    const uint32_t out = builder.addOutput(kQuant8, {1, 2, 2, 1}, 1.0f);
+    builder.addOperation(OperationType::ADD, {c1, c2, none}, {sum});
+    builder.addOperation(OperationType::ADD, {in, sum, none}, {out});
+
+    // the model reads the constants of the NNAPI model until it is compacted
+    const NeuralnetworksModel neuralNetworksModel = builder.build();
+    Model model(neuralNetworksModel);
+    ASSERT_TRUE(model.prepare());
+
+    EXPECT_EQ(1u, countNodes(model.getRecipe(), OP_QuantizedAdd_8p8to32));
+    EXPECT_TRUE(hasConstant(model.getRecipe(), {11, 22, 33, 44}));
+}
+
+TEST(ModelPrepareTest, DoesNotFoldOperationsOnInputs) {
+    // (in + c1) + c2
+    ModelBuilder builder;
+    const uint32_t in = builder.addInput(kQuant8, {1, 2, 2, 1}, 1.0f);
+    const uint32_t c1 = builder.addConstant(kQuant8, {1, 2, 2, 1},
+                                            std::vector<uint8_t>{1, 2, 3, 4}, 1.0f);
+    const uint32_t c2 = builder.addConstant(kQuant8, {1, 2, 2, 1},
+                                            std::vector<uint8_t>{10, 20, 30, 40}, 1.0f);
+    const uint32_t none = builder.addInt32(0);
+    const uint32_t sum = builder.addTemporary(kQuant8, {1, 2, 2, 1}, 1.0f);
+    const uint32_t out = builder.addOutput(kQuant8, {1, 2, 2, 1}, 1.0f);
+    builder.addOperation(OperationType::ADD, {in, c1, none}, {sum});
+    builder.addOperation(OperationType::ADD, {sum, c2, none}, {out});
+
+    // the model reads the constants of the NNAPI model until it is compacted
+    const NeuralnetworksModel neuralNetworksModel = builder.build();
+    Model model(neuralNetworksModel);
+    ASSERT_TRUE(model.prepare());
+
+    EXPECT_EQ(2u, countNodes(model.getRecipe(), OP_QuantizedAdd_8p8to32));
+}
+
+TEST(ModelPrepareTest, RemovesOperationsThatDoNotReachAnOutput) {
+    // in + in is the output; (in + c) + c is computed for nothing
+    ModelBuilder builder;
+    const uint32_t in = builder.addInput(kQuant8, {1, 2, 2, 1}, 1.0f);
+    const uint32_t c = builder.addConstant(kQuant8, {1, 2, 2, 1},
+                                           std::vector<uint8_t>{1, 2, 3, 4}, 1.0f);
+    const uint32_t none = builder.addInt32(0);
+    const uint32_t head = builder.addTemporary(kQuant8, {1, 2, 2, 1}, 1.0f);
+    const uint32_t tail = builder.addTemporary(kQuant8, {1, 2, 2, 1}, 1.0f);
+    const uint32_t out = builder.addOutput(kQuant8, {1, 2, 2, 1}, 1.0f);
+    builder.addOperation(OperationType::ADD, {in, c, none}, {head});
+    builder.addOperation(OperationType::ADD, {in, in, none}, {out});
+    builder.addOperation(OperationType::ADD, {head, c, none}, {tail});
+
+    const NeuralnetworksModel neuralNetworksModel = builder.build();
+    Model model(neuralNetworksModel);
+    ASSERT_TRUE(model.prepare());
+
+    EXPECT_EQ(1u, countNodes(model.getRecipe(), OP_QuantizedAdd_8p8to32));
+    EXPECT_FALSE(hasConstant(model.getRecipe(), {1, 2, 3, 4}));
+}
+
+TEST(ModelPrepareTest, KeepsOperationsFeedingAnOutput) {
+    // (in + c) + in, where only the last ADD writes the output
+    ModelBuilder builder;
+    const uint32_t in = builder.addInput(kQuant8, {1, 2, 2, 1}, 1.0f);
+    const uint32_t c = builder.addConstant(kQuant8, {1, 2, 2, 1},
+                                           std::vector<uint8_t>{1, 2, 3, 4}, 1.0f);
+    const uint32_t none = builder.addInt32(0);
+    const uint32_t sum = builder.addTemporary(kQuant8, {1, 2, 2, 1}, 1.0f);
+    const uint32_t out = builder.addOutput(kQuant8, {1, 2, 2, 1}, 1.0f);
+    builder.addOperation(OperationType::ADD, {in, c, none}, {sum});
+    builder.addOperation(OperationType::ADD, {sum, in, none}, {out});
+
+    const NeuralnetworksModel neuralNetworksModel = builder.build();
+    Model model(neuralNetworksModel);
+    ASSERT_TRUE(model.prepare());
+
+    EXPECT_EQ(2u, countNodes(model.getRecipe(), OP_QuantizedAdd_8p8to32));
+    EXPECT_TRUE(hasConstant(model.getRecipe(), {1, 2, 3, 4}));
+}
+
+// in [1, 2, 2, 4] -> RESHAPE to [1, 16], quantized at reshapedScale ->
+// RESHAPE to [1, 4, 4] -> out
+NeuralnetworksModel createReshapeChain(float reshapedScale) {
+    ModelBuilder builder;
+    const uint32_t in = builder.addInput(kQuant8, {1, 2, 2, 4}, 1.0f);
+    const uint32_t flat = builder.addConstant(OperandType::TENSOR_INT32, {2},
+                                              std::vector<int32_t>{1, 16});
+    const uint32_t square = builder.addConstant(OperandType::TENSOR_INT32, {3},
+                                                std::vector<int32_t>{1, 4, 4});
+    const uint32_t reshaped = builder.addTemporary(kQuant8, {1, 16}, reshapedScale);
+    const uint32_t out = builder.addOutput(kQuant8, {1, 4, 4}, reshapedScale);
+    builder.addOperation(OperationType::RESHAPE, {in, flat}, {reshaped});
+    builder.addOperation(OperationType::RESHAPE, {reshaped, square}, {out});
+    return builder.build();
+}
+
+// in [1, 2, 2, 4] -> RESHAPE to shape -> SOFTMAX -> out
+NeuralnetworksModel createReshapedSoftmax(const std::vector<int32_t>& shape) {
+    const std::vector<uint32_t> dimensions(shape.begin(), shape.end());
+    ModelBuilder builder;
+    const uint32_t in = builder.addInput(kQuant8, {1, 2, 2, 4}, 1.0f);
+    const uint32_t target = builder.addConstant(
+        OperandType::TENSOR_INT32, {static_cast<uint32_t>(shape.size())}, shape);
+    const uint32_t beta = builder.addConstant(OperandType::FLOAT32, {}, std::vector<float>{1.0f});
+    const uint32_t reshaped = builder.addTemporary(kQuant8, dimensions, 1.0f);
+    const uint32_t out = builder.addOutput(kQuant8, dimensions, 1.0f / 256);
+    builder.addOperation(OperationType::RESHAPE, {in, target}, {reshaped});
+    builder.addOperation(OperationType::SOFTMAX, {reshaped, beta}, {out});
+    return builder.build();
+}
+
+TEST(ModelPrepareTest, BypassesReshapeOfReshape) {
+    const NeuralnetworksModel neuralNetworksModel = createReshapeChain(1.0f);
+    Model model(neuralNetworksModel);
+    ASSERT_TRUE(model.prepare());
+
+    // the second reshape reads the input, leaving the first one dead
+    EXPECT_EQ(1u, countNodes(model.getRecipe(), OP_QuantizedReshape));
+}
+
+TEST(ModelPrepareTest, KeepsReshapeThatChangesQuantization) {
+    const NeuralnetworksModel neuralNetworksModel = createReshapeChain(0.5f);
+    Model model(neuralNetworksModel);
+    ASSERT_TRUE(model.prepare());
+
+    EXPECT_EQ(2u, countNodes(model.getRecipe(), OP_QuantizedReshape));
+}
+
+TEST(ModelPrepareTest, BypassesReshapeKeepingTheRowsOfSoftmax) {
+    const NeuralnetworksModel neuralNetworksModel = createReshapedSoftmax({4, 4});
+    Model model(neuralNetworksModel);
+    ASSERT_TRUE(model.prepare());
+
+    EXPECT_EQ(0u, countNodes(model.getRecipe(), OP_QuantizedReshape));
+    EXPECT_EQ(1u, countNodes(model.getRecipe(), OP_QuantizedSoftmax_8));
+}
+
+TEST(ModelPrepareTest, KeepsReshapeChangingTheRowsOfSoftmax) {
+    const NeuralnetworksModel neuralNetworksModel = createReshapedSoftmax({1, 16});
+    Model model(neuralNetworksModel);
+    ASSERT_TRUE(model.prepare());
+
+    EXPECT_EQ(1u, countNodes(model.getRecipe(), OP_QuantizedReshape));
+}
+
+}  // anonymous namespace
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <vector>
+#include "HexagonRequestValidator.h"
+
+namespace android {
+namespace hardware {
+namespace neuralnetworks {
+namespace V1_0 {
+namespace implementation {
+namespace hexagon {
+namespace {
+
+constexpr uint32_t kPoolSize = 64;
+
+RequestArgument createArgument(uint32_t poolIndex, uint32_t offset, uint32_t length,
+                               const std::vector<uint32_t>& dimensions = {}) {
+    return {
+        .hasNoValue = false,
+        .location = {.poolIndex = poolIndex, .offset = offset, .length = length},
+        .dimensions = dimensions,
+    };
+}
+
+// one [1, 2, 2, 1] input and one output of unknown batches
+RequestValidator createValidator() {
+    return RequestValidator({Dimensions(std::vector<uint32_t>{1, 2, 2, 1})},
+                            {Dimensions(std::vector<uint32_t>{0, 2, 2, 1})});
+}
+
+Request createRequest() {
+    Request request;
+    request.inputs = std::vector<RequestArgument>{createArgument(0, 0, 4)};
+    request.outputs = std::vector<RequestArgument>{createArgument(0, 8, 4, {1, 2, 2, 1})};
+    request.pools = std::vector<hidl_memory>{hidl_memory("ashmem", hidl_handle(), kPoolSize)};
+    return request;
+}
+
+TEST(RequestValidatorTest, AcceptsValidRequest) {
+    EXPECT_TRUE(createValidator().validate(createRequest()));
+}
+
+TEST(RequestValidatorTest, RejectsWrongArgumentCount) {
+    Request request = createRequest();
+    request.inputs = std::vector<RequestArgument>{createArgument(0, 0, 4), createArgument(0, 4, 4)};
+    EXPECT_FALSE(createValidator().validate(request));
+}
+
+TEST(RequestValidatorTest, RejectsInvalidPool) {
+    Request request = createRequest();
+    request.inputs[0].location.poolIndex = 1;
+    EXPECT_FALSE(createValidator().validate(request));
+}
+
+TEST(RequestValidatorTest, RejectsArgumentOutOfItsPool) {
+    Request request = createRequest();
+    request.outputs[0].location.offset = kPoolSize - 2;
+    EXPECT_FALSE(createValidator().validate(request));
+
+    // the end of the argument must not wrap around
+    request.outputs[0].location.offset = 0xffffffff;
+    EXPECT_FALSE(createValidator().validate(request));
+}
+
+TEST(RequestValidatorTest, RejectsUnsupportedMemory) {
+    Request request = createRequest();
+    request.pools = std::vector<hidl_memory>{hidl_memory("gralloc", hidl_handle(), kPoolSize)};
+    EXPECT_FALSE(createValidator().validate(request));
+}
+
+TEST(RequestValidatorTest, RejectsNoValueWithLocation) {
+    Request request = createRequest();
+    request.inputs[0].hasNoValue = true;
+    EXPECT_FALSE(createValidator().validate(request));
+
+    request.inputs[0].location = {.poolIndex = 0, .offset = 0, .length = 0};
+    EXPECT_TRUE(createValidator().validate(request));
+}
+
+TEST(RequestValidatorTest, ChecksDimensionsAgainstTheModel) {
+    Request request = createRequest();
+
+    // known dimensions may be restated, unknown ones may be specified
+    request.inputs[0].dimensions = std::vector<uint32_t>{1, 2, 2, 1};
+    request.outputs[0].dimensions = std::vector<uint32_t>{3, 2, 2, 1};
+    EXPECT_TRUE(createValidator().validate(request));
+
+    request.inputs[0].dimensions = std::vector<uint32_t>{2, 2, 2, 1};
+    EXPECT_FALSE(createValidator().validate(request));
+
+    request.inputs[0].dimensions = std::vector<uint32_t>{1, 2, 2};
+    EXPECT_FALSE(createValidator().validate(request));
+}
+
+}  // anonymous namespace
+}  // namespace hexagon
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace neuralnetworks
+}  // namespace hardware
+}  // namespace android